@@ -8,8 +8,6 @@ execute_process(
         OUTPUT_STRIP_TRAILING_WHITESPACE
 )
 
-set(KERNELHEADERS_DIR /lib/modules/${KERNEL_RELEASE}/build)
-
 message(STATUS "Kernel release: ${KERNEL_RELEASE}")
 # Find the headers
 find_path(KERNELHEADERS_DIR
@@ -0,0 +1,76 @@
+//
+// Codec bus cost of AC'97 masked writes: the AC'97 reads and writes of the
+// probe, then of 10 rounds of three masked updates to codec 0 (set a vendor
+// mixer bit, clear a jack bit, change the master volume), each with the
+// virtual time they took. The rounds run twice: first while the codec is new
+// and careful, then again after 50 more writes to the master volume have made
+// it trusted. The simulated clock makes the output deterministic.
+//
+
+#include <hosted/xonar_hosted.h>
+
+#include <sound/ac97_codec.h>
+
+#include "main.h"
+
+#define MASKED_ROUNDS 10
+#define MASKED_WARMUP 50
+
+static void print_ac97(const char *what, unsigned long long start_ns)
+{
+    printf("%-20s ac97 reads %lu writes %lu, %llu us\n", what,
+           oxygen_sim.stats.ac97_reads, oxygen_sim.stats.ac97_writes,
+           (hosted_clock_ns - start_ns) / 1000);
+}
+
+static void masked_rounds(struct xonar *chip, const char *what)
+{
+    unsigned long long start;
+    int i;
+
+    oxygen_sim_clear_stats();
+    start = hosted_clock_ns;
+    for (i = 0; i < MASKED_ROUNDS; ++i) {
+        oxygen_ac97_set_bits(chip, 0, CM9780_MIXER, CM9780_PCBSW);
+        oxygen_ac97_clear_bits(chip, 0, CM9780_JACK, i & 1 ? CM9780_RSOE : 0);
+        oxygen_write_ac97_masked(chip, 0, AC97_MASTER, i, 0x1f);
+    }
+    print_ac97(what, start);
+}
+
+int main(void)
+{
+    struct xonar *chip;
+    unsigned long long start;
+    int i;
+
+    oxygen_sim_reset();
+    hosted_log_enabled = 0;
+    start = hosted_clock_ns;
+    if (xonar_hosted_probe() < 0) {
+        fprintf(stderr, "probe failed\n");
+        return 1;
+    }
+    print_ac97("probe:", start);
+    chip = xonar_hosted_chip();
+
+    masked_rounds(chip, "30 masked updates:");
+    for (i = 0; i < MASKED_WARMUP; ++i)
+        oxygen_write_ac97(chip, 0, AC97_MASTER,
+                          oxygen_sim.ac97[0][AC97_MASTER / 2]);
+    masked_rounds(chip, "30 more, trusted:");
+
+    // volatile, so it is read every time
+    oxygen_sim_clear_stats();
+    start = hosted_clock_ns;
+    oxygen_ac97_clear_bits(chip, 0, CM9780_GPIO_STATUS, CM9780_GPO0);
+    print_ac97("GPIO status update:", start);
+
+    printf("codec 0: mixer %04x jack %04x master %04x\n",
+           oxygen_sim.ac97[0][CM9780_MIXER / 2],
+           oxygen_sim.ac97[0][CM9780_JACK / 2],
+           oxygen_sim.ac97[0][AC97_MASTER / 2]);
+
+    xonar_hosted_remove();
+    return 0;
+}
@@ -0,0 +1,119 @@
+//
+// Microbenchmark of the per-period register paths: the pointer callback, a
+// pause/release trigger pair and the interrupt handler of the simulated card.
+// Prints the median of 5 runs of 1M calls each, in TSC cycles per call on
+// x86 and in nanoseconds elsewhere. The simulated port accesses are included.
+// Build the hosted tree with CMAKE_BUILD_TYPE=Release for meaningful numbers.
+//
+
+#include <hosted/xonar_hosted.h>
+
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "main.h"
+
+#define BENCH_CALLS 1000000
+#define BENCH_RUNS  5
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_UNIT "cycles"
+
+static unsigned long long bench_now(void)
+{
+    return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+
+static unsigned long long bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+enum { BENCH_POINTER, BENCH_TRIGGER, BENCH_INTERRUPT, BENCH_COUNT };
+
+static const char *const bench_names[BENCH_COUNT] = {
+        "pointer",
+        "trigger (pause)",
+        "interrupt",
+};
+
+// tenths of a unit per call, of every run
+static unsigned long long bench_results[BENCH_COUNT][BENCH_RUNS];
+
+static int compare_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main(void)
+{
+    struct snd_pcm_substream *substream;
+    const struct snd_pcm_ops *ops;
+    volatile unsigned long sink = 0;
+    unsigned long long start;
+    int run, i, k;
+
+    oxygen_sim_reset();
+    hosted_log_enabled = 0;
+    if (xonar_hosted_probe() < 0) {
+        fprintf(stderr, "probe failed\n");
+        return 1;
+    }
+    hosted_run_work();
+
+    substream = xonar_hosted_playback_open();
+    xonar_hosted_hw_params(substream, 48000, 2, SNDRV_PCM_FORMAT_S16_LE,
+                           4096, 16384);
+    ops = substream->pcm->ops;
+    ops->prepare(substream);
+    ops->trigger(substream, SNDRV_PCM_TRIGGER_START);
+
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        start = bench_now();
+        for (i = 0; i < BENCH_CALLS; ++i)
+            sink += ops->pointer(substream);
+        bench_results[BENCH_POINTER][run] =
+                (bench_now() - start) / (BENCH_CALLS / 10);
+
+        start = bench_now();
+        for (i = 0; i < BENCH_CALLS; ++i) {
+            ops->trigger(substream, SNDRV_PCM_TRIGGER_PAUSE_PUSH);
+            ops->trigger(substream, SNDRV_PCM_TRIGGER_PAUSE_RELEASE);
+        }
+        bench_results[BENCH_TRIGGER][run] =
+                (bench_now() - start) / (2 * BENCH_CALLS / 10);
+
+        start = bench_now();
+        for (i = 0; i < BENCH_CALLS; ++i)
+            oxygen_sim_raise(OXYGEN_INT_GPIO);
+        bench_results[BENCH_INTERRUPT][run] =
+                (bench_now() - start) / (BENCH_CALLS / 10);
+    }
+
+    for (k = 0; k < BENCH_COUNT; ++k) {
+        unsigned long long median;
+
+        qsort(bench_results[k], BENCH_RUNS, sizeof(bench_results[k][0]),
+              compare_ull);
+        median = bench_results[k][BENCH_RUNS / 2];
+        printf("%-16s %llu.%llu %s/call\n", bench_names[k],
+               median / 10, median % 10, BENCH_UNIT);
+    }
+
+    ops->trigger(substream, SNDRV_PCM_TRIGGER_STOP);
+    xonar_hosted_playback_close(substream);
+    xonar_hosted_remove();
+    return 0;
+}
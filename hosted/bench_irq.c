@@ -0,0 +1,69 @@
+//
+// Time our interrupt holds the shared line: raises 200000 PCM period and
+// 200000 GPIO interrupts on the simulated card during playback, and prints
+// the virtual time spent in the primary (hard interrupt) handler per
+// interrupt, the port accesses per interrupt of both handler parts together
+// and the hard handler calls against the thread runs. The thread runs from
+// hosted_run_work() after each interrupt. The simulated clock makes the
+// output deterministic.
+//
+
+#include <hosted/xonar_hosted.h>
+
+#include "main.h"
+
+#define IRQ_COUNT 200000
+
+static const struct {
+    const char *name;
+    u16 status;
+} irq_sources[] = {
+        { "period (multich)", OXYGEN_CHANNEL_MULTICH },
+        { "gpio", OXYGEN_INT_GPIO },
+};
+
+int main(void)
+{
+    struct snd_pcm_substream *substream;
+    const struct snd_pcm_ops *ops;
+    unsigned int k, i;
+
+    oxygen_sim_reset();
+    hosted_log_enabled = 0;
+    if (xonar_hosted_probe() < 0) {
+        fprintf(stderr, "probe failed\n");
+        return 1;
+    }
+    hosted_run_work();
+
+    substream = xonar_hosted_playback_open();
+    xonar_hosted_hw_params(substream, 48000, 2, SNDRV_PCM_FORMAT_S16_LE,
+                           4096, 16384);
+    ops = substream->pcm->ops;
+    ops->prepare(substream);
+    ops->trigger(substream, SNDRV_PCM_TRIGGER_START);
+
+    hosted_irq_defer_thread = true;
+    for (k = 0; k < sizeof(irq_sources) / sizeof(irq_sources[0]); ++k) {
+        unsigned long accesses = oxygen_sim_port_accesses();
+
+        memset(&hosted_irq_stats, 0, sizeof(hosted_irq_stats));
+        for (i = 0; i < IRQ_COUNT; ++i) {
+            oxygen_sim_raise(irq_sources[k].status);
+            hosted_run_work();
+        }
+        printf("%-17s hard part %llu ns (max %llu ns), "
+               "%.1f port accesses per interrupt, %lu hard / %lu threads\n",
+               irq_sources[k].name,
+               (unsigned long long) hosted_irq_stats.hard_ns / IRQ_COUNT,
+               (unsigned long long) hosted_irq_stats.hard_max_ns,
+               (double) (oxygen_sim_port_accesses() - accesses) / IRQ_COUNT,
+               hosted_irq_stats.hard_irqs, hosted_irq_stats.threads);
+    }
+    hosted_irq_defer_thread = false;
+
+    ops->trigger(substream, SNDRV_PCM_TRIGGER_STOP);
+    xonar_hosted_playback_close(substream);
+    xonar_hosted_remove();
+    return 0;
+}
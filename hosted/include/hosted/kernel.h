@@ -0,0 +1,482 @@
+//
+// Userspace stand-ins for the kernel APIs used by the Xonar driver.
+//
+// Only what the driver really calls is here. Time is virtual: sleeps and delays
+// advance hosted_clock_ns instead of blocking, so runs are fast and repeatable.
+//
+
+#ifndef HOSTED_KERNEL_H
+#define HOSTED_KERNEL_H
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// <string.h> is not included on purpose: with glibc it declares index(), which
+// clashes with the "index" module parameter array in main.c
+char *strcpy(char *dest, const char *src);
+char *strncpy(char *dest, const char *src, size_t n);
+char *strcat(char *dest, const char *src);
+int strcmp(const char *a, const char *b);
+size_t strlen(const char *s);
+void *memset(void *s, int c, size_t n);
+void *memcpy(void *dest, const void *src, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+// TYPES
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint16_t __le16;
+typedef uint32_t __le32;
+typedef u64 dma_addr_t;
+typedef s64 ktime_t;
+typedef unsigned long kernel_ulong_t;
+
+// the hosted build only targets little-endian machines
+#define cpu_to_le16(x)	((__le16)(x))
+#define cpu_to_le32(x)	((__le32)(x))
+#define le16_to_cpu(x)	((u16)(x))
+#define le32_to_cpu(x)	((u32)(x))
+
+// ERRORS
+#define EPERM		1
+#define ENOENT		2
+#define EIO		5
+#define ENXIO		6
+#define EAGAIN		11
+#define ENOMEM		12
+#define EBUSY		16
+#define ENODEV		19
+#define EINVAL		22
+#define ETIMEDOUT	110
+
+// GENERAL MACROS
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+#define ALIGN(x, a)	(((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define PTR_ALIGN(p, a)	((__typeof__(p))ALIGN((unsigned long)(p), (a)))
+#define L1_CACHE_BYTES	64
+#define ____cacheline_aligned	__attribute__((__aligned__(L1_CACHE_BYTES)))
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+#define offsetofend(type, member) \
+    (offsetof(type, member) + sizeof(((type *)0)->member))
+#define min(a, b)	((a) < (b) ? (a) : (b))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+#define min_t(type, a, b)	min((type)(a), (type)(b))
+#define BIT(n)		(1UL << (n))
+// index of the lowest set bit, the word must not be zero
+#define __ffs(word)	((unsigned long)__builtin_ctzl(word))
+#ifndef __always_inline
+#define __always_inline	inline __attribute__((always_inline))
+#endif
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+#define READ_ONCE(x)	(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+
+#define __init
+#define __exit
+#define __iomem
+
+// MODULE
+#define THIS_MODULE	NULL
+#define KBUILD_MODNAME	"xonar"
+#define EXPORT_SYMBOL(sym)	extern int hosted_module_dummy
+#define MODULE_AUTHOR(x)	extern int hosted_module_dummy
+#define MODULE_DESCRIPTION(x)	extern int hosted_module_dummy
+#define MODULE_LICENSE(x)	extern int hosted_module_dummy
+#define MODULE_PARM_DESC(n, x)	extern int hosted_module_dummy
+#define MODULE_DEVICE_TABLE(t, n)	extern int hosted_module_dummy
+#define MODULE_SUPPORTED_DEVICE(x)
+#define module_param_array(n, t, p, perm)	extern int hosted_module_dummy
+#define module_param(n, t, perm)	extern int hosted_module_dummy
+#define module_init(fn)	int hosted_module_init(void) { return fn(); }
+#define module_exit(fn)	void hosted_module_exit(void) { fn(); }
+
+int hosted_module_init(void);
+void hosted_module_exit(void);
+
+// LOGGING
+#define KERN_CRIT	"<2>"
+#define KERN_ERR	"<3>"
+#define KERN_WARNING	"<4>"
+#define KERN_NOTICE	"<5>"
+#define KERN_INFO	"<6>"
+#define KERN_DEBUG	"<7>"
+
+struct device {
+    const char *name;
+};
+
+// set to false to silence the driver's log
+extern bool hosted_log_enabled;
+
+__attribute__((format(printf, 1, 2)))
+int printk(const char *fmt, ...);
+
+#define dev_err(dev, fmt, ...)	printk(KERN_ERR fmt, ##__VA_ARGS__)
+#define dev_warn(dev, fmt, ...)	printk(KERN_WARNING fmt, ##__VA_ARGS__)
+#define dev_notice(dev, fmt, ...)	printk(KERN_NOTICE fmt, ##__VA_ARGS__)
+#define dev_info(dev, fmt, ...)	printk(KERN_INFO fmt, ##__VA_ARGS__)
+#define dev_dbg(dev, fmt, ...)	printk(KERN_DEBUG fmt, ##__VA_ARGS__)
+#define dev_crit(dev, fmt, ...)	printk(KERN_CRIT fmt, ##__VA_ARGS__)
+
+#define WARN_ON(cond)	({ bool __c = !!(cond);			\
+    if (__c)								\
+        printk(KERN_WARNING "WARN_ON(%s)\n", #cond);			\
+    __c;								\
+})
+// like the kernel's, the condition only has to be constant after inlining
+#define __hosted_build_bug(cond, msg, n)	do { \
+    extern void hosted_build_bug_##n(void) __attribute__((error(msg))); \
+    if (cond) \
+        hosted_build_bug_##n(); \
+} while (0)
+#define _hosted_build_bug(cond, msg, n)	__hosted_build_bug(cond, msg, n)
+#define BUILD_BUG_ON(cond)	\
+    _hosted_build_bug(cond, "BUILD_BUG_ON failed: " #cond, __COUNTER__)
+
+// TIME
+#define HZ		1000
+#define NSEC_PER_USEC	1000L
+#define NSEC_PER_MSEC	1000000L
+#define NSEC_PER_SEC	1000000000L
+
+// virtual clock in nanoseconds, advanced by delays and simulated port I/O
+extern u64 hosted_clock_ns;
+
+static inline void hosted_clock_advance(u64 ns)
+{
+    hosted_clock_ns += ns;
+}
+
+#define jiffies		((unsigned long)(hosted_clock_ns / (NSEC_PER_SEC / HZ)))
+
+static inline unsigned long msecs_to_jiffies(unsigned int ms)
+{
+    return ms * HZ / 1000;
+}
+
+static inline unsigned long usecs_to_jiffies(unsigned int us)
+{
+    return (us * HZ + 999999) / 1000000;
+}
+
+static inline void msleep(unsigned int ms)
+{
+    hosted_clock_advance((u64)ms * NSEC_PER_MSEC);
+}
+
+static inline void usleep_range(unsigned long min_us, unsigned long max_us)
+{
+    hosted_clock_advance((u64)min_us * NSEC_PER_USEC);
+}
+
+static inline void udelay(unsigned long us)
+{
+    hosted_clock_advance((u64)us * NSEC_PER_USEC);
+}
+
+static inline void ndelay(unsigned long ns)
+{
+    hosted_clock_advance(ns);
+}
+
+static inline void cpu_relax(void)
+{
+}
+
+static inline ktime_t ktime_get(void)
+{
+    return (ktime_t)hosted_clock_ns;
+}
+
+#define ktime_sub(a, b)		((a) - (b))
+#define ktime_add_ns(a, ns)	((a) + (ns))
+#define ktime_to_ns(a)		((s64)(a))
+#define ktime_to_us(a)		((s64)(a) / NSEC_PER_USEC)
+#define ktime_to_ms(a)		((s64)(a) / NSEC_PER_MSEC)
+#define ns_to_ktime(ns)		((ktime_t)(ns))
+#define ms_to_ktime(ms)		((ktime_t)(ms) * NSEC_PER_MSEC)
+
+// LOCKING
+// Everything runs on one thread; the locks only count how often they are taken.
+typedef struct {
+    unsigned int depth;
+} spinlock_t;
+
+struct mutex {
+    unsigned int depth;
+};
+
+#define spin_lock_init(l)	((l)->depth = 0)
+#define spin_lock(l)		((l)->depth++)
+#define spin_unlock(l)		((l)->depth--)
+#define spin_lock_irq(l)	((l)->depth++)
+#define spin_unlock_irq(l)	((l)->depth--)
+#define spin_lock_irqsave(l, f)	((void)(f = 0), (l)->depth++)
+#define spin_unlock_irqrestore(l, f)	((void)(f), (l)->depth--)
+
+// ATOMICS
+typedef struct {
+    int counter;
+} atomic_t;
+
+#define atomic_read(v)		((v)->counter)
+#define atomic_set(v, i)	((v)->counter = (i))
+#define atomic_or(i, v)		((v)->counter |= (i))
+
+static inline int atomic_xchg(atomic_t *v, int i)
+{
+    int old = v->counter;
+
+    v->counter = i;
+    return old;
+}
+
+#define mutex_init(m)		((m)->depth = 0)
+#define mutex_destroy(m)	((void)(m))
+#define mutex_lock(m)		((m)->depth++)
+#define mutex_unlock(m)		((m)->depth--)
+#define mutex_lock_interruptible(m)	((m)->depth++, 0)
+
+// WAIT QUEUES
+typedef struct {
+    unsigned int wakeups;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(q)	((q)->wakeups = 0)
+#define wake_up(q)		((q)->wakeups++)
+
+/*
+ * Re-evaluate the condition once per virtual jiffy until it holds or the
+ * timeout expires. Returns the remaining jiffies (at least 1) or 0.
+ */
+#define wait_event_timeout(wq, condition, timeout)			\
+({									\
+    long __left = (long)(timeout);					\
+    bool __done = (condition);					\
+    while (!__done && __left > 0) {				\
+        hosted_clock_advance(NSEC_PER_SEC / HZ);		\
+        --__left;						\
+        __done = (condition);					\
+    }								\
+    (void)(wq);							\
+    __done ? (__left > 0 ? __left : 1) : 0;			\
+})
+
+// COMPLETIONS
+struct completion {
+    unsigned int done;
+};
+
+#define init_completion(c)	((c)->done = 0)
+#define reinit_completion(c)	((c)->done = 0)
+#define complete(c)		((c)->done++)
+
+// like wait_event_timeout(); takes one completion
+#define wait_for_completion_timeout(c, timeout)			\
+({									\
+    unsigned long __r = wait_event_timeout(0, (c)->done, timeout);	\
+    if (__r)								\
+        (c)->done--;							\
+    __r;								\
+})
+
+// WORKQUEUES
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+    work_func_t func;
+    bool pending;
+    // virtual time before which the work doesn't run
+    u64 expires_ns;
+    struct work_struct *next;
+};
+
+struct delayed_work {
+    struct work_struct work;
+};
+
+#define INIT_WORK(w, f)	((w)->func = (f), (w)->pending = false, (w)->next = NULL)
+#define INIT_DELAYED_WORK(dw, f)	INIT_WORK(&(dw)->work, f)
+#define to_delayed_work(w)	container_of(w, struct delayed_work, work)
+
+bool schedule_work(struct work_struct *work);
+bool flush_work(struct work_struct *work);
+bool cancel_work_sync(struct work_struct *work);
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+bool flush_delayed_work(struct delayed_work *dwork);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+// run the timers and work that are due by now, like the system workqueue would
+void hosted_run_work(void);
+
+// HIGH-RESOLUTION TIMERS
+// Expired timers are fired from hosted_run_work() against the virtual clock.
+#define CLOCK_MONOTONIC		1
+#define HRTIMER_MODE_REL	1
+
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART,
+};
+
+struct hrtimer {
+    enum hrtimer_restart (*function)(struct hrtimer *timer);
+    u64 expires_ns;
+    bool queued;
+    struct hrtimer *next;
+};
+
+void hrtimer_init(struct hrtimer *timer, int clock_id, int mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, int mode);
+int hrtimer_cancel(struct hrtimer *timer);
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval);
+
+// INTERRUPTS
+typedef int irqreturn_t;
+#define IRQ_NONE	0
+#define IRQ_HANDLED	1
+#define IRQ_WAKE_THREAD	2
+#define IRQF_SHARED	0x00000080
+
+typedef irqreturn_t (*irq_handler_t)(int irq, void *dev_id);
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
+                const char *name, void *dev_id);
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+                         irq_handler_t thread_fn, unsigned long flags,
+                         const char *name, void *dev_id);
+void free_irq(unsigned int irq, void *dev_id);
+
+/*
+ * Deliver an interrupt to the registered handler, if any. When the handler
+ * wakes its thread, the thread runs right after it, as if it got the CPU at
+ * once, unless hosted_irq_defer_thread is set; then it runs from
+ * hosted_run_work().
+ */
+irqreturn_t hosted_raise_irq(void);
+extern bool hosted_irq_defer_thread;
+
+// the time in the primary (hard interrupt) handler is what the other devices
+// on a shared line wait for
+struct hosted_irq_stats {
+    unsigned long hard_irqs;
+    unsigned long threads;
+    u64 hard_ns;
+    u64 hard_max_ns;
+};
+
+extern struct hosted_irq_stats hosted_irq_stats;
+
+// PORT I/O is implemented by the simulated CMI8788 in oxygen_sim.c
+u8 oxygen_sim_in8(unsigned long port);
+u16 oxygen_sim_in16(unsigned long port);
+u32 oxygen_sim_in32(unsigned long port);
+void oxygen_sim_out8(u8 value, unsigned long port);
+void oxygen_sim_out16(u16 value, unsigned long port);
+void oxygen_sim_out32(u32 value, unsigned long port);
+
+#define inb(port)	oxygen_sim_in8(port)
+#define inw(port)	oxygen_sim_in16(port)
+#define inl(port)	oxygen_sim_in32(port)
+#define outb(v, port)	oxygen_sim_out8(v, port)
+#define outw(v, port)	oxygen_sim_out16(v, port)
+#define outl(v, port)	oxygen_sim_out32(v, port)
+
+// PCI
+#define PCI_ANY_ID		(~0U)
+#define PCI_VENDOR_ID_CMEDIA	0x13f6
+#define PCI_VENDOR_ID_PLX	0x10b5
+#define PCI_VENDOR_ID_TI	0x104c
+#define IORESOURCE_IO		0x00000100
+
+struct pci_device_id {
+    u32 vendor, device;
+    u32 subvendor, subdevice;
+    u32 class, class_mask;
+    kernel_ulong_t driver_data;
+};
+
+#define PCI_DEVICE(vend, dev) \
+    .vendor = (vend), .device = (dev), \
+    .subvendor = PCI_ANY_ID, .subdevice = PCI_ANY_ID
+#define PCI_VDEVICE(vend, dev) \
+    .vendor = PCI_VENDOR_ID_##vend, .device = (dev), \
+    .subvendor = PCI_ANY_ID, .subdevice = PCI_ANY_ID
+#define PCI_DEVICE_SUB(vend, dev, subvend, subdev) \
+    .vendor = (vend), .device = (dev), \
+    .subvendor = (subvend), .subdevice = (subdev)
+
+struct pci_dev;
+
+struct pci_bus {
+    struct pci_dev *self;
+};
+
+struct pci_dev {
+    struct device dev;
+    struct pci_bus *bus;
+    u16 vendor, device;
+    u16 subsystem_vendor, subsystem_device;
+    unsigned int irq;
+    unsigned long resource_start;
+    unsigned long resource_len;
+    unsigned long resource_flags;
+    void *driver_data;
+};
+
+struct pci_driver {
+    const char *name;
+    const struct pci_device_id *id_table;
+    int (*probe)(struct pci_dev *dev, const struct pci_device_id *id);
+    void (*remove)(struct pci_dev *dev);
+    void (*shutdown)(struct pci_dev *dev);
+};
+
+#define pci_resource_start(pci, bar)	((pci)->resource_start)
+#define pci_resource_len(pci, bar)	((pci)->resource_len)
+#define pci_resource_flags(pci, bar)	((pci)->resource_flags)
+
+static inline int pci_enable_device(struct pci_dev *pci) { return 0; }
+static inline void pci_disable_device(struct pci_dev *pci) { }
+static inline int pci_request_regions(struct pci_dev *pci, const char *name) { return 0; }
+static inline void pci_release_regions(struct pci_dev *pci) { }
+static inline void pci_set_master(struct pci_dev *pci) { }
+static inline void pci_set_drvdata(struct pci_dev *pci, void *data)
+{
+    pci->driver_data = data;
+}
+static inline void *pci_get_drvdata(struct pci_dev *pci)
+{
+    return pci->driver_data;
+}
+static inline int pci_read_config_dword(struct pci_dev *pci, int where, u32 *val)
+{
+    *val = 0;
+    return 0;
+}
+static inline int pci_write_config_dword(struct pci_dev *pci, int where, u32 val)
+{
+    return 0;
+}
+
+const struct pci_device_id *pci_match_id(const struct pci_device_id *ids,
+                                         struct pci_dev *dev);
+int pci_register_driver(struct pci_driver *driver);
+void pci_unregister_driver(struct pci_driver *driver);
+// driver registered by the module init function
+extern struct pci_driver *hosted_pci_driver;
+
+#endif //HOSTED_KERNEL_H
@@ -0,0 +1,81 @@
+//
+// Simulated CMI8788 (Oxygen) register file for the hosted build.
+//
+// The 256-byte I/O space behaves like plain memory, except for the registers
+// with side effects the driver depends on: the 2-wire (I2C) bus, the AC'97
+// command register, read-to-clear status bytes and interrupt acknowledge.
+//
+
+#ifndef HOSTED_OXYGEN_SIM_H
+#define HOSTED_OXYGEN_SIM_H
+
+#include <hosted/kernel.h>
+
+// port address at which the simulated card is "plugged in"
+#define OXYGEN_SIM_IOPORT	0xe000UL
+#define OXYGEN_SIM_IO_SIZE	0x100
+#define OXYGEN_SIM_IRQ		17
+
+// width index for the per-width counters: 0 = 8 bits, 1 = 16 bits, 2 = 32 bits
+#define OXYGEN_SIM_WIDTHS	3
+
+// I2C device addresses of the DACs as the driver sends them
+#define OXYGEN_SIM_I2C_CS4398	0x9e
+#define OXYGEN_SIM_I2C_CS4362A	0x30
+
+struct oxygen_sim_stats {
+    // port transactions by width
+    unsigned long reads[OXYGEN_SIM_WIDTHS];
+    unsigned long writes[OXYGEN_SIM_WIDTHS];
+    // 2-wire transfers started and reads of a busy bus status
+    unsigned long i2c_writes;
+    unsigned long i2c_busy_polls;
+    // AC'97 commands issued through OXYGEN_AC97_REGS
+    unsigned long ac97_reads;
+    unsigned long ac97_writes;
+    // commands that failed on purpose, see ac97_failure_rate
+    unsigned long ac97_lost;
+    unsigned long ac97_dropped;
+    // interrupts delivered to the driver
+    unsigned long irqs;
+};
+
+struct oxygen_sim {
+    u8 regs[OXYGEN_SIM_IO_SIZE];
+    // AC'97 codec registers, indexed by register number / 2
+    u16 ac97[2][0x40];
+    // last value written to each DAC control register
+    u8 cs4398[16];
+    u8 cs4362a[16];
+
+    // cost of one port transaction in virtual nanoseconds
+    u64 read_ns;
+    u64 write_ns;
+    // the 2-wire bus reports busy until this virtual time
+    u64 i2c_busy_until;
+
+    /*
+     * Per cent of AC'97 commands that fail like the real controller does:
+     * half of them are lost (never reported done), the other half are
+     * reported done but don't reach the codec. The failures are chosen by a
+     * pseudo-random sequence that starts again at ac97_seed on every reset.
+     */
+    unsigned int ac97_failure_rate;
+    u32 ac97_seed;
+    u32 ac97_random;
+
+    struct oxygen_sim_stats stats;
+};
+
+extern struct oxygen_sim oxygen_sim;
+
+// put the register file in its power-on state and clear the counters
+void oxygen_sim_reset(void);
+// clear only the counters
+void oxygen_sim_clear_stats(void);
+// total number of port transactions so far
+unsigned long oxygen_sim_port_accesses(void);
+// set interrupt status bits and deliver the interrupt if unmasked
+void oxygen_sim_raise(u16 status);
+
+#endif //HOSTED_OXYGEN_SIM_H
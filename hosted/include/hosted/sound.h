@@ -0,0 +1,428 @@
+//
+// Userspace stand-ins for the ALSA core used by the Xonar driver.
+//
+// Cards, PCMs and controls are plain heap objects; the hosted entry points in
+// xonar_hosted.c drive them the way the ALSA middle layer would.
+//
+
+#ifndef HOSTED_SOUND_H
+#define HOSTED_SOUND_H
+
+#include <hosted/kernel.h>
+
+// CARD
+#define SNDRV_CARDS		8
+#define SNDRV_DEFAULT_IDX	{ [0 ... (SNDRV_CARDS - 1)] = -1 }
+#define SNDRV_DEFAULT_STR	{ [0 ... (SNDRV_CARDS - 1)] = NULL }
+#define SNDRV_DEFAULT_ENABLE_PNP	{ [0 ... (SNDRV_CARDS - 1)] = 1 }
+
+struct snd_kcontrol;
+struct snd_info_entry;
+struct snd_info_buffer;
+
+struct snd_card {
+    int number;
+    char id[16];
+    char driver[16];
+    char shortname[32];
+    char longname[80];
+    char components[128];
+    struct device *dev;
+    void *private_data;
+    void (*private_free)(struct snd_card *card);
+    // controls in the order they were added
+    struct snd_kcontrol *controls;
+    unsigned int controls_count;
+    struct snd_info_entry *proc;
+    bool registered;
+};
+
+int snd_card_new(struct device *parent, int idx, const char *xid,
+                 void *module, int extra_size, struct snd_card **card_ret);
+int snd_card_free(struct snd_card *card);
+int snd_card_register(struct snd_card *card);
+int snd_component_add(struct snd_card *card, const char *component);
+
+// PROC
+struct snd_info_buffer {
+    char *buffer;
+    size_t len;
+    size_t size;
+};
+
+struct snd_info_entry {
+    void *private_data;
+    void (*read)(struct snd_info_entry *entry, struct snd_info_buffer *buffer);
+    char name[32];
+};
+
+int snd_card_ro_proc_new(struct snd_card *card, const char *name,
+                         void *private_data,
+                         void (*read)(struct snd_info_entry *,
+                                      struct snd_info_buffer *));
+__attribute__((format(printf, 2, 3)))
+int snd_iprintf(struct snd_info_buffer *buffer, const char *fmt, ...);
+
+// IEC958
+#define IEC958_AES1_CON_PCM_CODER	0x02
+
+// AC'97 registers used on the CM9780
+#define AC97_RESET		0x00
+#define AC97_MASTER		0x02
+#define AC97_HEADPHONE		0x04
+#define AC97_PC_BEEP		0x0a
+#define AC97_MIC		0x0e
+#define AC97_LINE		0x10
+#define AC97_CD			0x12
+#define AC97_VIDEO		0x14
+#define AC97_AUX		0x16
+#define AC97_PCM		0x18
+#define AC97_REC_SEL		0x1a
+#define AC97_REC_GAIN		0x1c
+#define AC97_POWERDOWN		0x26
+#define AC97_EXTENDED_STATUS	0x2a
+#define AC97_CENTER_LFE_MASTER	0x36
+#define AC97_SURROUND_MASTER	0x38
+
+#define AC97_PD_PR0		0x0100
+#define AC97_PD_PR1		0x0200
+#define AC97_PD_PR2		0x0400
+#define AC97_PD_PR3		0x0800
+#define AC97_PD_PR4		0x1000
+#define AC97_PD_PR5		0x2000
+#define AC97_PD_PR6		0x4000
+#define AC97_PD_EAPD		0x8000
+#define AC97_EA_PRI		0x0800
+#define AC97_EA_PRJ		0x1000
+#define AC97_EA_PRK		0x2000
+
+// CONTROLS
+#define SNDRV_CTL_ELEM_IFACE_CARD	1
+#define SNDRV_CTL_ELEM_IFACE_MIXER	2
+#define SNDRV_CTL_ELEM_IFACE_PCM	3
+
+#define SNDRV_CTL_ELEM_TYPE_NONE	0
+#define SNDRV_CTL_ELEM_TYPE_BOOLEAN	1
+#define SNDRV_CTL_ELEM_TYPE_INTEGER	2
+#define SNDRV_CTL_ELEM_TYPE_ENUMERATED	3
+#define SNDRV_CTL_ELEM_TYPE_BYTES	4
+
+#define SNDRV_CTL_ELEM_ACCESS_READ	(1 << 0)
+#define SNDRV_CTL_ELEM_ACCESS_WRITE	(1 << 1)
+#define SNDRV_CTL_ELEM_ACCESS_READWRITE	(SNDRV_CTL_ELEM_ACCESS_READ | \
+                                         SNDRV_CTL_ELEM_ACCESS_WRITE)
+#define SNDRV_CTL_ELEM_ACCESS_VOLATILE	(1 << 2)
+#define SNDRV_CTL_ELEM_ACCESS_TLV_READ	(1 << 4)
+#define SNDRV_CTL_ELEM_ACCESS_INACTIVE	(1 << 8)
+
+#define SNDRV_CTL_EVENT_MASK_VALUE	(1 << 0)
+#define SNDRV_CTL_EVENT_MASK_INFO	(1 << 1)
+
+struct snd_ctl_elem_id {
+    unsigned int numid;
+    int iface;
+    unsigned int device;
+    unsigned int subdevice;
+    char name[44];
+    unsigned int index;
+};
+
+struct snd_ctl_elem_info {
+    struct snd_ctl_elem_id id;
+    int type;
+    unsigned int access;
+    unsigned int count;
+    union {
+        struct {
+            long min;
+            long max;
+            long step;
+        } integer;
+        struct {
+            unsigned int items;
+            unsigned int item;
+            char name[64];
+        } enumerated;
+    } value;
+};
+
+struct snd_ctl_elem_value {
+    struct snd_ctl_elem_id id;
+    union {
+        struct {
+            long value[128];
+        } integer;
+        struct {
+            unsigned int item[128];
+        } enumerated;
+        struct {
+            unsigned char data[512];
+        } bytes;
+    } value;
+};
+
+typedef int (snd_kcontrol_info_t)(struct snd_kcontrol *kcontrol,
+                                  struct snd_ctl_elem_info *uinfo);
+typedef int (snd_kcontrol_get_t)(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol);
+typedef int (snd_kcontrol_put_t)(struct snd_kcontrol *kcontrol,
+                                 struct snd_ctl_elem_value *ucontrol);
+
+struct snd_kcontrol_new {
+    int iface;
+    unsigned int device;
+    unsigned int subdevice;
+    const char *name;
+    unsigned int index;
+    unsigned int access;
+    unsigned int count;
+    snd_kcontrol_info_t *info;
+    snd_kcontrol_get_t *get;
+    snd_kcontrol_put_t *put;
+    union {
+        const unsigned int *p;
+    } tlv;
+    unsigned long private_value;
+};
+
+struct snd_kcontrol {
+    struct snd_ctl_elem_id id;
+    unsigned int count;
+    unsigned int access;
+    snd_kcontrol_info_t *info;
+    snd_kcontrol_get_t *get;
+    snd_kcontrol_put_t *put;
+    union {
+        const unsigned int *p;
+    } tlv;
+    unsigned long private_value;
+    void *private_data;
+    void (*private_free)(struct snd_kcontrol *kcontrol);
+    // number of snd_ctl_notify() calls, in place of events to user space
+    unsigned int notifications;
+    struct snd_kcontrol *next;
+};
+
+struct snd_kcontrol *snd_ctl_new1(const struct snd_kcontrol_new *kcontrolnew,
+                                  void *private_data);
+int snd_ctl_add(struct snd_card *card, struct snd_kcontrol *kcontrol);
+void snd_ctl_notify(struct snd_card *card, unsigned int mask,
+                    struct snd_ctl_elem_id *id);
+int snd_ctl_boolean_mono_info(struct snd_kcontrol *kcontrol,
+                              struct snd_ctl_elem_info *uinfo);
+int snd_ctl_enum_info(struct snd_ctl_elem_info *info, unsigned int channels,
+                      unsigned int items, const char *const names[]);
+
+// TLV
+#define SNDRV_CTL_TLVT_DB_SCALE		1
+#define SNDRV_CTL_TLVD_DB_SCALE_MASK	0xffff
+#define SNDRV_CTL_TLVD_DB_SCALE_MUTE	0x10000
+#define DECLARE_TLV_DB_SCALE(name, min, step, mute) \
+    unsigned int name[] = { SNDRV_CTL_TLVT_DB_SCALE, 2 * sizeof(unsigned int), \
+        (unsigned int)(min), \
+        ((step) & SNDRV_CTL_TLVD_DB_SCALE_MASK) | \
+        ((mute) ? SNDRV_CTL_TLVD_DB_SCALE_MUTE : 0) }
+
+// PCM
+typedef unsigned long snd_pcm_uframes_t;
+typedef int snd_pcm_format_t;
+
+#define SNDRV_PCM_STREAM_PLAYBACK	0
+#define SNDRV_PCM_STREAM_CAPTURE	1
+
+#define SNDRV_PCM_INFO_MMAP		0x00000001
+#define SNDRV_PCM_INFO_MMAP_VALID	0x00000002
+#define SNDRV_PCM_INFO_BLOCK_TRANSFER	0x00010000
+#define SNDRV_PCM_INFO_INTERLEAVED	0x00000100
+#define SNDRV_PCM_INFO_PAUSE		0x00080000
+#define SNDRV_PCM_INFO_SYNC_START	0x00400000
+#define SNDRV_PCM_INFO_NO_PERIOD_WAKEUP	0x00800000
+
+#define SNDRV_PCM_FORMAT_S16_LE		2
+#define SNDRV_PCM_FORMAT_S24_LE		6
+#define SNDRV_PCM_FORMAT_S32_LE		10
+#define SNDRV_PCM_FMTBIT_S16_LE		(1ULL << SNDRV_PCM_FORMAT_S16_LE)
+#define SNDRV_PCM_FMTBIT_S24_LE		(1ULL << SNDRV_PCM_FORMAT_S24_LE)
+#define SNDRV_PCM_FMTBIT_S32_LE		(1ULL << SNDRV_PCM_FORMAT_S32_LE)
+
+#define SNDRV_PCM_RATE_32000		(1 << 1)
+#define SNDRV_PCM_RATE_44100		(1 << 2)
+#define SNDRV_PCM_RATE_48000		(1 << 3)
+#define SNDRV_PCM_RATE_64000		(1 << 4)
+#define SNDRV_PCM_RATE_88200		(1 << 5)
+#define SNDRV_PCM_RATE_96000		(1 << 6)
+#define SNDRV_PCM_RATE_176400		(1 << 7)
+#define SNDRV_PCM_RATE_192000		(1 << 8)
+
+#define SNDRV_PCM_TRIGGER_STOP		0
+#define SNDRV_PCM_TRIGGER_START		1
+#define SNDRV_PCM_TRIGGER_PAUSE_PUSH	3
+#define SNDRV_PCM_TRIGGER_PAUSE_RELEASE	4
+#define SNDRV_PCM_TRIGGER_SUSPEND	5
+#define SNDRV_PCM_TRIGGER_RESUME	6
+
+#define SNDRV_PCM_HW_PARAM_FORMAT	1
+#define SNDRV_PCM_HW_PARAM_CHANNELS	10
+#define SNDRV_PCM_HW_PARAM_RATE		11
+#define SNDRV_PCM_HW_PARAM_PERIOD_BYTES	14
+#define SNDRV_PCM_HW_PARAM_BUFFER_BYTES	18
+
+#define SNDRV_DMA_TYPE_DEV		2
+
+struct snd_pcm_hardware {
+    unsigned int info;
+    u64 formats;
+    unsigned int rates;
+    unsigned int rate_min;
+    unsigned int rate_max;
+    unsigned int channels_min;
+    unsigned int channels_max;
+    size_t buffer_bytes_max;
+    size_t period_bytes_min;
+    size_t period_bytes_max;
+    unsigned int periods_min;
+    unsigned int periods_max;
+    size_t fifo_size;
+};
+
+// the negotiated parameters, already reduced to single values
+struct snd_pcm_hw_params {
+    unsigned int rate;
+    unsigned int channels;
+    snd_pcm_format_t format;
+    unsigned int period_bytes;
+    unsigned int buffer_bytes;
+};
+
+#define params_rate(p)		((p)->rate)
+#define params_channels(p)	((p)->channels)
+#define params_format(p)	((p)->format)
+#define params_period_bytes(p)	((p)->period_bytes)
+#define params_buffer_bytes(p)	((p)->buffer_bytes)
+
+int snd_pcm_format_width(snd_pcm_format_t format);
+int snd_pcm_format_physical_width(snd_pcm_format_t format);
+
+struct snd_pcm_runtime {
+    struct snd_pcm_hardware hw;
+    void *private_data;
+    dma_addr_t dma_addr;
+    unsigned char *dma_area;
+    size_t dma_bytes;
+    int no_period_wakeup;
+    unsigned int rate;
+    unsigned int channels;
+    snd_pcm_format_t format;
+    unsigned int frame_bits;
+};
+
+struct snd_pcm;
+
+struct snd_pcm_substream {
+    struct snd_pcm *pcm;
+    struct snd_pcm_runtime *runtime;
+    void *private_data;
+    int stream;
+    // number of snd_pcm_period_elapsed() calls
+    unsigned int periods_elapsed;
+};
+
+struct snd_pcm_ops {
+    int (*open)(struct snd_pcm_substream *substream);
+    int (*close)(struct snd_pcm_substream *substream);
+    int (*ioctl)(struct snd_pcm_substream *substream,
+                 unsigned int cmd, void *arg);
+    int (*hw_params)(struct snd_pcm_substream *substream,
+                     struct snd_pcm_hw_params *params);
+    int (*hw_free)(struct snd_pcm_substream *substream);
+    int (*prepare)(struct snd_pcm_substream *substream);
+    int (*trigger)(struct snd_pcm_substream *substream, int cmd);
+    snd_pcm_uframes_t (*pointer)(struct snd_pcm_substream *substream);
+};
+
+struct snd_pcm {
+    struct snd_card *card;
+    void *private_data;
+    char name[80];
+    const struct snd_pcm_ops *ops;
+    struct snd_pcm_substream playback;
+    struct snd_pcm_runtime playback_runtime;
+};
+
+#define snd_pcm_substream_chip(substream)	((substream)->private_data)
+#define snd_pcm_group_for_each_entry(s, substream) \
+    for ((s) = (substream); (s); (s) = NULL)
+
+static inline snd_pcm_uframes_t bytes_to_frames(struct snd_pcm_runtime *runtime,
+                                                size_t size)
+{
+    return size * 8 / runtime->frame_bits;
+}
+
+int snd_pcm_new(struct snd_card *card, const char *id, int device,
+                int playback_count, int capture_count,
+                struct snd_pcm **rpcm);
+void snd_pcm_set_ops(struct snd_pcm *pcm, int direction,
+                     const struct snd_pcm_ops *ops);
+void snd_pcm_set_sync(struct snd_pcm_substream *substream);
+void snd_pcm_trigger_done(struct snd_pcm_substream *substream,
+                          struct snd_pcm_substream *master);
+void snd_pcm_period_elapsed(struct snd_pcm_substream *substream);
+int snd_pcm_lib_ioctl(struct snd_pcm_substream *substream,
+                      unsigned int cmd, void *arg);
+int snd_pcm_lib_malloc_pages(struct snd_pcm_substream *substream, size_t size);
+int snd_pcm_lib_free_pages(struct snd_pcm_substream *substream);
+void snd_pcm_lib_preallocate_pages_for_all(struct snd_pcm *pcm, int type,
+                                           void *data, size_t size,
+                                           size_t max);
+#define snd_dma_pci_data(pci)	((void *)(pci))
+
+int snd_pcm_hw_constraint_step(struct snd_pcm_runtime *runtime,
+                               unsigned int cond, int var, unsigned long step);
+int snd_pcm_hw_constraint_msbits(struct snd_pcm_runtime *runtime,
+                                 unsigned int cond, unsigned int width,
+                                 unsigned int msbits);
+
+// CHANNEL MAPS
+enum {
+    SNDRV_CHMAP_UNKNOWN = 0,
+    SNDRV_CHMAP_NA,
+    SNDRV_CHMAP_MONO,
+    SNDRV_CHMAP_FL,
+    SNDRV_CHMAP_FR,
+    SNDRV_CHMAP_RL,
+    SNDRV_CHMAP_RR,
+    SNDRV_CHMAP_FC,
+    SNDRV_CHMAP_LFE,
+    SNDRV_CHMAP_SL,
+    SNDRV_CHMAP_SR,
+    SNDRV_CHMAP_RC,
+};
+
+struct snd_pcm_chmap_elem {
+    unsigned char channels;
+    unsigned char map[15];
+};
+
+struct snd_pcm_chmap {
+    struct snd_pcm *pcm;
+    int stream;
+    struct snd_kcontrol *kctl;
+    const struct snd_pcm_chmap_elem *chmap;
+    unsigned int max_channels;
+    unsigned int channel_mask;
+    void *private_data;
+};
+
+#define SND_PCM_CHMAP_MASK_2468	0x0154
+
+// mono, stereo, 4.0, 5.1 and 7.1 in ALSA channel order
+extern const struct snd_pcm_chmap_elem snd_pcm_std_chmaps[];
+
+// adds the read-only "Playback Channel Map" control to the card of the PCM
+int snd_pcm_add_chmap_ctls(struct snd_pcm *pcm, int stream,
+                           const struct snd_pcm_chmap_elem *chmap,
+                           int max_channels, unsigned long private_value,
+                           struct snd_pcm_chmap **info_ret);
+
+#endif //HOSTED_SOUND_H
@@ -0,0 +1,48 @@
+//
+// Entry points for driving the Xonar driver in the hosted build.
+//
+// They stand in for the PCI core and the ALSA middle layer: probe and remove
+// the simulated card, open the playback substream and look up controls.
+// Typical use:
+//
+//     oxygen_sim_reset();
+//     xonar_hosted_probe();
+//     oxygen_sim_clear_stats();
+//     substream = xonar_hosted_playback_open();
+//     xonar_hosted_hw_params(substream, 48000, 2, SNDRV_PCM_FORMAT_S16_LE,
+//                            4096, 16384);
+//     ... read hosted_clock_ns and oxygen_sim.stats ...
+//     xonar_hosted_playback_close(substream);
+//     xonar_hosted_remove();
+//
+
+#ifndef HOSTED_XONAR_HOSTED_H
+#define HOSTED_XONAR_HOSTED_H
+
+#include <hosted/kernel.h>
+#include <hosted/oxygen_sim.h>
+#include <hosted/sound.h>
+
+// load the module and probe the simulated card
+int xonar_hosted_probe(void);
+// remove the card and unload the module
+void xonar_hosted_remove(void);
+
+struct snd_card *xonar_hosted_card(void);
+// struct xonar of the probed card (see sound/pci/xonar/main.h)
+void *xonar_hosted_chip(void);
+
+struct snd_pcm_substream *xonar_hosted_playback_open(void);
+int xonar_hosted_hw_params(struct snd_pcm_substream *substream,
+                           unsigned int rate, unsigned int channels,
+                           snd_pcm_format_t format, unsigned int period_bytes,
+                           unsigned int buffer_bytes);
+void xonar_hosted_playback_close(struct snd_pcm_substream *substream);
+
+// control with the given name, or NULL
+struct snd_kcontrol *xonar_hosted_control(const char *name);
+
+// render /proc/asound/cardN/xonar into buf, returns the length
+size_t xonar_hosted_read_proc(char *buf, size_t size);
+
+#endif //HOSTED_XONAR_HOSTED_H
@@ -0,0 +1,2 @@
+// hosted build: see hosted/include/hosted/kernel.h
+#include <hosted/kernel.h>
@@ -0,0 +1,2 @@
+// hosted build: see hosted/include/hosted/sound.h
+#include <hosted/sound.h>
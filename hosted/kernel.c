@@ -0,0 +1,652 @@
+//
+// Userspace implementation of the kernel and ALSA stand-ins, see
+// hosted/include/hosted/kernel.h and hosted/include/hosted/sound.h
+//
+
+#include <hosted/kernel.h>
+#include <hosted/sound.h>
+
+u64 hosted_clock_ns;
+bool hosted_log_enabled = true;
+
+int printk(const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (!hosted_log_enabled)
+        return 0;
+    // skip the "<n>" level prefix
+    if (fmt[0] == '<' && fmt[1] && fmt[2] == '>')
+        fmt += 3;
+    va_start(args, fmt);
+    len = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return len;
+}
+
+// WORKQUEUES
+
+static struct work_struct *work_head;
+
+static bool queue_work_at(struct work_struct *work, u64 expires_ns)
+{
+    struct work_struct **tail;
+
+    if (work->pending)
+        return false;
+    work->pending = true;
+    work->expires_ns = expires_ns;
+    work->next = NULL;
+    for (tail = &work_head; *tail; tail = &(*tail)->next)
+        ;
+    *tail = work;
+    return true;
+}
+
+bool schedule_work(struct work_struct *work)
+{
+    return queue_work_at(work, 0);
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+    return queue_work_at(&dwork->work,
+                         hosted_clock_ns + (u64)delay * (NSEC_PER_SEC / HZ));
+}
+
+static bool dequeue_work(struct work_struct *work)
+{
+    struct work_struct **p;
+
+    for (p = &work_head; *p; p = &(*p)->next) {
+        if (*p == work) {
+            *p = work->next;
+            work->pending = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool flush_work(struct work_struct *work)
+{
+    if (!dequeue_work(work))
+        return false;
+    work->func(work);
+    return true;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+    return dequeue_work(work);
+}
+
+bool flush_delayed_work(struct delayed_work *dwork)
+{
+    return flush_work(&dwork->work);
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+    return cancel_work_sync(&dwork->work);
+}
+
+static bool run_timers(void);
+static bool irq_thread_pending;
+static void run_irq_thread(void);
+
+void hosted_run_work(void)
+{
+    struct work_struct *work;
+
+    for (;;) {
+        if (irq_thread_pending) {
+            run_irq_thread();
+            continue;
+        }
+        for (work = work_head; work; work = work->next)
+            if (work->expires_ns <= hosted_clock_ns)
+                break;
+        if (!work) {
+            if (run_timers())
+                continue;
+            return;
+        }
+        dequeue_work(work);
+        work->func(work);
+    }
+}
+
+// HIGH-RESOLUTION TIMERS
+
+static struct hrtimer *timer_head;
+
+static bool dequeue_timer(struct hrtimer *timer)
+{
+    struct hrtimer **p;
+
+    for (p = &timer_head; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            timer->queued = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void enqueue_timer(struct hrtimer *timer)
+{
+    timer->queued = true;
+    timer->next = timer_head;
+    timer_head = timer;
+}
+
+// fire every expired timer once, true if any was fired
+static bool run_timers(void)
+{
+    struct hrtimer *timer;
+    bool fired = false;
+
+    for (;;) {
+        for (timer = timer_head; timer; timer = timer->next)
+            if (timer->expires_ns <= hosted_clock_ns)
+                break;
+        if (!timer)
+            return fired;
+        dequeue_timer(timer);
+        fired = true;
+        if (timer->function(timer) == HRTIMER_RESTART && !timer->queued)
+            enqueue_timer(timer);
+    }
+}
+
+void hrtimer_init(struct hrtimer *timer, int clock_id, int mode)
+{
+    timer->function = NULL;
+    timer->queued = false;
+    timer->next = NULL;
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, int mode)
+{
+    dequeue_timer(timer);
+    timer->expires_ns = hosted_clock_ns + tim;
+    enqueue_timer(timer);
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+    return dequeue_timer(timer);
+}
+
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+    u64 overruns = 0;
+
+    while (timer->expires_ns <= hosted_clock_ns) {
+        timer->expires_ns += interval;
+        ++overruns;
+    }
+    return overruns;
+}
+
+// INTERRUPTS
+
+static irq_handler_t irq_handler;
+static irq_handler_t irq_thread_fn;
+static void *irq_dev_id;
+
+bool hosted_irq_defer_thread;
+struct hosted_irq_stats hosted_irq_stats;
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags,
+                const char *name, void *dev_id)
+{
+    return request_threaded_irq(irq, handler, NULL, flags, name, dev_id);
+}
+
+int request_threaded_irq(unsigned int irq, irq_handler_t handler,
+                         irq_handler_t thread_fn, unsigned long flags,
+                         const char *name, void *dev_id)
+{
+    if (irq_handler)
+        return -EBUSY;
+    irq_handler = handler;
+    irq_thread_fn = thread_fn;
+    irq_dev_id = dev_id;
+    irq_thread_pending = false;
+    return 0;
+}
+
+static void run_irq_thread(void)
+{
+    irq_thread_pending = false;
+    ++hosted_irq_stats.threads;
+    irq_thread_fn(0, irq_dev_id);
+}
+
+void free_irq(unsigned int irq, void *dev_id)
+{
+    if (irq_dev_id != dev_id)
+        return;
+    // like the kernel, let a woken thread finish first
+    if (irq_thread_pending)
+        run_irq_thread();
+    irq_handler = NULL;
+}
+
+irqreturn_t hosted_raise_irq(void)
+{
+    irqreturn_t ret;
+    u64 start = hosted_clock_ns;
+
+    if (!irq_handler)
+        return IRQ_NONE;
+    ret = irq_handler(0, irq_dev_id);
+    ++hosted_irq_stats.hard_irqs;
+    hosted_irq_stats.hard_ns += hosted_clock_ns - start;
+    if (hosted_clock_ns - start > hosted_irq_stats.hard_max_ns)
+        hosted_irq_stats.hard_max_ns = hosted_clock_ns - start;
+    if (ret == IRQ_WAKE_THREAD && irq_thread_fn) {
+        irq_thread_pending = true;
+        if (!hosted_irq_defer_thread)
+            run_irq_thread();
+        ret = IRQ_HANDLED;
+    }
+    return ret;
+}
+
+// PCI
+
+struct pci_driver *hosted_pci_driver;
+
+static bool pci_id_matches(u32 id, u32 want)
+{
+    return want == PCI_ANY_ID || want == id;
+}
+
+const struct pci_device_id *pci_match_id(const struct pci_device_id *ids,
+                                         struct pci_dev *dev)
+{
+    for (; ids && (ids->vendor || ids->subvendor); ++ids)
+        if (pci_id_matches(dev->vendor, ids->vendor) &&
+            pci_id_matches(dev->device, ids->device) &&
+            pci_id_matches(dev->subsystem_vendor, ids->subvendor) &&
+            pci_id_matches(dev->subsystem_device, ids->subdevice))
+            return ids;
+    return NULL;
+}
+
+int pci_register_driver(struct pci_driver *driver)
+{
+    hosted_pci_driver = driver;
+    return 0;
+}
+
+void pci_unregister_driver(struct pci_driver *driver)
+{
+    if (hosted_pci_driver == driver)
+        hosted_pci_driver = NULL;
+}
+
+// CARD
+
+int snd_card_new(struct device *parent, int idx, const char *xid,
+                 void *module, int extra_size, struct snd_card **card_ret)
+{
+    struct snd_card *card;
+
+    card = calloc(1, sizeof(*card) + extra_size);
+    if (!card)
+        return -ENOMEM;
+    card->dev = parent;
+    card->number = idx < 0 ? 0 : idx;
+    if (extra_size > 0)
+        card->private_data = card + 1;
+    *card_ret = card;
+    return 0;
+}
+
+int snd_card_free(struct snd_card *card)
+{
+    struct snd_kcontrol *ctl, *next;
+
+    if (card->private_free)
+        card->private_free(card);
+    for (ctl = card->controls; ctl; ctl = next) {
+        next = ctl->next;
+        if (ctl->private_free)
+            ctl->private_free(ctl);
+        free(ctl);
+    }
+    free(card->proc);
+    free(card);
+    return 0;
+}
+
+int snd_card_register(struct snd_card *card)
+{
+    card->registered = true;
+    return 0;
+}
+
+int snd_component_add(struct snd_card *card, const char *component)
+{
+    if (strlen(card->components) + strlen(component) + 2 >
+        sizeof(card->components))
+        return -ENOMEM;
+    if (card->components[0])
+        strcat(card->components, " ");
+    strcat(card->components, component);
+    return 0;
+}
+
+// PROC
+
+int snd_card_ro_proc_new(struct snd_card *card, const char *name,
+                         void *private_data,
+                         void (*read)(struct snd_info_entry *,
+                                      struct snd_info_buffer *))
+{
+    struct snd_info_entry *entry = calloc(1, sizeof(*entry));
+
+    if (!entry)
+        return -ENOMEM;
+    entry->private_data = private_data;
+    entry->read = read;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    free(card->proc);
+    card->proc = entry;
+    return 0;
+}
+
+int snd_iprintf(struct snd_info_buffer *buffer, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (buffer->len >= buffer->size)
+        return 0;
+    va_start(args, fmt);
+    len = vsnprintf(buffer->buffer + buffer->len, buffer->size - buffer->len,
+                    fmt, args);
+    va_end(args);
+    if (len > 0)
+        buffer->len = min(buffer->len + len, buffer->size);
+    return len;
+}
+
+// CONTROLS
+
+struct snd_kcontrol *snd_ctl_new1(const struct snd_kcontrol_new *kcontrolnew,
+                                  void *private_data)
+{
+    struct snd_kcontrol *kctl = calloc(1, sizeof(*kctl));
+
+    if (!kctl)
+        return NULL;
+    kctl->id.iface = kcontrolnew->iface;
+    kctl->id.device = kcontrolnew->device;
+    kctl->id.subdevice = kcontrolnew->subdevice;
+    kctl->id.index = kcontrolnew->index;
+    if (kcontrolnew->name)
+        snprintf(kctl->id.name, sizeof(kctl->id.name), "%s",
+                 kcontrolnew->name);
+    kctl->count = kcontrolnew->count ? kcontrolnew->count : 1;
+    kctl->access = kcontrolnew->access ? kcontrolnew->access
+                                       : SNDRV_CTL_ELEM_ACCESS_READWRITE;
+    kctl->info = kcontrolnew->info;
+    kctl->get = kcontrolnew->get;
+    kctl->put = kcontrolnew->put;
+    kctl->tlv.p = kcontrolnew->tlv.p;
+    kctl->private_value = kcontrolnew->private_value;
+    kctl->private_data = private_data;
+    return kctl;
+}
+
+int snd_ctl_add(struct snd_card *card, struct snd_kcontrol *kcontrol)
+{
+    struct snd_kcontrol **tail;
+
+    for (tail = &card->controls; *tail; tail = &(*tail)->next)
+        ;
+    *tail = kcontrol;
+    kcontrol->id.numid = ++card->controls_count;
+    return 0;
+}
+
+void snd_ctl_notify(struct snd_card *card, unsigned int mask,
+                    struct snd_ctl_elem_id *id)
+{
+    struct snd_kcontrol *ctl;
+
+    for (ctl = card->controls; ctl; ctl = ctl->next)
+        if (&ctl->id == id || ctl->id.numid == id->numid)
+            ++ctl->notifications;
+}
+
+int snd_ctl_boolean_mono_info(struct snd_kcontrol *kcontrol,
+                              struct snd_ctl_elem_info *uinfo)
+{
+    uinfo->type = SNDRV_CTL_ELEM_TYPE_BOOLEAN;
+    uinfo->count = 1;
+    uinfo->value.integer.min = 0;
+    uinfo->value.integer.max = 1;
+    return 0;
+}
+
+int snd_ctl_enum_info(struct snd_ctl_elem_info *info, unsigned int channels,
+                      unsigned int items, const char *const names[])
+{
+    info->type = SNDRV_CTL_ELEM_TYPE_ENUMERATED;
+    info->count = channels;
+    info->value.enumerated.items = items;
+    if (!items)
+        return 0;
+    if (info->value.enumerated.item >= items)
+        info->value.enumerated.item = items - 1;
+    snprintf(info->value.enumerated.name, sizeof(info->value.enumerated.name),
+             "%s", names[info->value.enumerated.item]);
+    return 0;
+}
+
+// PCM
+
+int snd_pcm_format_width(snd_pcm_format_t format)
+{
+    switch (format) {
+    case SNDRV_PCM_FORMAT_S16_LE: return 16;
+    case SNDRV_PCM_FORMAT_S24_LE: return 24;
+    case SNDRV_PCM_FORMAT_S32_LE: return 32;
+    default: return -EINVAL;
+    }
+}
+
+int snd_pcm_format_physical_width(snd_pcm_format_t format)
+{
+    switch (format) {
+    case SNDRV_PCM_FORMAT_S16_LE: return 16;
+    case SNDRV_PCM_FORMAT_S24_LE:
+    case SNDRV_PCM_FORMAT_S32_LE: return 32;
+    default: return -EINVAL;
+    }
+}
+
+int snd_pcm_new(struct snd_card *card, const char *id, int device,
+                int playback_count, int capture_count,
+                struct snd_pcm **rpcm)
+{
+    struct snd_pcm *pcm = calloc(1, sizeof(*pcm));
+
+    if (!pcm)
+        return -ENOMEM;
+    pcm->card = card;
+    pcm->playback.pcm = pcm;
+    pcm->playback.stream = SNDRV_PCM_STREAM_PLAYBACK;
+    *rpcm = pcm;
+    return 0;
+}
+
+void snd_pcm_set_ops(struct snd_pcm *pcm, int direction,
+                     const struct snd_pcm_ops *ops)
+{
+    if (direction == SNDRV_PCM_STREAM_PLAYBACK)
+        pcm->ops = ops;
+}
+
+void snd_pcm_set_sync(struct snd_pcm_substream *substream)
+{
+}
+
+void snd_pcm_trigger_done(struct snd_pcm_substream *substream,
+                          struct snd_pcm_substream *master)
+{
+}
+
+void snd_pcm_period_elapsed(struct snd_pcm_substream *substream)
+{
+    ++substream->periods_elapsed;
+}
+
+int snd_pcm_lib_ioctl(struct snd_pcm_substream *substream,
+                      unsigned int cmd, void *arg)
+{
+    return 0;
+}
+
+// bus address the simulated DMA buffers pretend to live at
+#define HOSTED_DMA_ADDR		0x10000000
+
+int snd_pcm_lib_malloc_pages(struct snd_pcm_substream *substream, size_t size)
+{
+    struct snd_pcm_runtime *runtime = substream->runtime;
+
+    if (runtime->dma_area && runtime->dma_bytes >= size)
+        return 0;
+    free(runtime->dma_area);
+    runtime->dma_area = calloc(1, size);
+    if (!runtime->dma_area)
+        return -ENOMEM;
+    runtime->dma_bytes = size;
+    runtime->dma_addr = HOSTED_DMA_ADDR;
+    return 1;
+}
+
+int snd_pcm_lib_free_pages(struct snd_pcm_substream *substream)
+{
+    struct snd_pcm_runtime *runtime = substream->runtime;
+
+    free(runtime->dma_area);
+    runtime->dma_area = NULL;
+    runtime->dma_bytes = 0;
+    return 0;
+}
+
+void snd_pcm_lib_preallocate_pages_for_all(struct snd_pcm *pcm, int type,
+                                           void *data, size_t size,
+                                           size_t max)
+{
+}
+
+int snd_pcm_hw_constraint_step(struct snd_pcm_runtime *runtime,
+                               unsigned int cond, int var, unsigned long step)
+{
+    return 0;
+}
+
+int snd_pcm_hw_constraint_msbits(struct snd_pcm_runtime *runtime,
+                                 unsigned int cond, unsigned int width,
+                                 unsigned int msbits)
+{
+    return 0;
+}
+
+const struct snd_pcm_chmap_elem snd_pcm_std_chmaps[] = {
+        { .channels = 1,
+          .map = { SNDRV_CHMAP_MONO } },
+        { .channels = 2,
+          .map = { SNDRV_CHMAP_FL, SNDRV_CHMAP_FR } },
+        { .channels = 4,
+          .map = { SNDRV_CHMAP_FL, SNDRV_CHMAP_FR,
+                   SNDRV_CHMAP_RL, SNDRV_CHMAP_RR } },
+        { .channels = 6,
+          .map = { SNDRV_CHMAP_FL, SNDRV_CHMAP_FR,
+                   SNDRV_CHMAP_RL, SNDRV_CHMAP_RR,
+                   SNDRV_CHMAP_FC, SNDRV_CHMAP_LFE } },
+        { .channels = 8,
+          .map = { SNDRV_CHMAP_FL, SNDRV_CHMAP_FR,
+                   SNDRV_CHMAP_RL, SNDRV_CHMAP_RR,
+                   SNDRV_CHMAP_FC, SNDRV_CHMAP_LFE,
+                   SNDRV_CHMAP_SL, SNDRV_CHMAP_SR } },
+        { }
+};
+
+// the map of the open stream, all zeroes while it is closed
+static int chmap_ctl_get(struct snd_kcontrol *kcontrol,
+                         struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_pcm_chmap *info = kcontrol->private_data;
+    struct snd_pcm_runtime *runtime = info->pcm->playback.runtime;
+    const struct snd_pcm_chmap_elem *map;
+    unsigned int i;
+
+    for (i = 0; i < info->max_channels; ++i)
+        ucontrol->value.integer.value[i] = 0;
+    if (!runtime)
+        return 0;
+    for (map = info->chmap; map->channels; ++map) {
+        if (map->channels != runtime->channels)
+            continue;
+        for (i = 0; i < map->channels && i < info->max_channels; ++i)
+            ucontrol->value.integer.value[i] = map->map[i];
+        return 0;
+    }
+    return -EINVAL;
+}
+
+static void chmap_ctl_free(struct snd_kcontrol *kcontrol)
+{
+    free(kcontrol->private_data);
+}
+
+int snd_pcm_add_chmap_ctls(struct snd_pcm *pcm, int stream,
+                           const struct snd_pcm_chmap_elem *chmap,
+                           int max_channels, unsigned long private_value,
+                           struct snd_pcm_chmap **info_ret)
+{
+    struct snd_kcontrol_new knew = {
+            .iface = SNDRV_CTL_ELEM_IFACE_PCM,
+            .name = stream == SNDRV_PCM_STREAM_PLAYBACK ?
+                    "Playback Channel Map" : "Capture Channel Map",
+            .access = SNDRV_CTL_ELEM_ACCESS_READ |
+                      SNDRV_CTL_ELEM_ACCESS_VOLATILE |
+                      SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+            .count = max_channels,
+            .get = chmap_ctl_get,
+    };
+    struct snd_pcm_chmap *info;
+    int err;
+
+    info = calloc(1, sizeof(*info));
+    if (!info)
+        return -ENOMEM;
+    info->pcm = pcm;
+    info->stream = stream;
+    info->chmap = chmap;
+    info->max_channels = max_channels;
+    info->channel_mask = private_value;
+    info->kctl = snd_ctl_new1(&knew, info);
+    if (!info->kctl) {
+        free(info);
+        return -ENOMEM;
+    }
+    info->kctl->private_free = chmap_ctl_free;
+    err = snd_ctl_add(pcm->card, info->kctl);
+    if (err < 0)
+        return err;
+    if (info_ret)
+        *info_ret = info;
+    return 0;
+}
@@ -0,0 +1,265 @@
+//
+// Simulated CMI8788 register file, see hosted/include/hosted/oxygen_sim.h
+//
+
+#include <hosted/oxygen_sim.h>
+
+#include "oxygen_regs.h"
+
+struct oxygen_sim oxygen_sim;
+
+// bit times of one 2-wire write: start, address, map, data (each acked), stop
+#define I2C_WRITE_BITS		29
+
+static unsigned int width_index(unsigned int bytes)
+{
+    return bytes == 1 ? 0 : bytes == 2 ? 1 : 2;
+}
+
+static unsigned int port_offset(unsigned long port, unsigned int bytes)
+{
+    unsigned long offset = port - OXYGEN_SIM_IOPORT;
+
+    if (port < OXYGEN_SIM_IOPORT || offset + bytes > OXYGEN_SIM_IO_SIZE) {
+        fprintf(stderr, "oxygen_sim: access outside the I/O range at 0x%lx\n",
+                port);
+        abort();
+    }
+    return offset;
+}
+
+void oxygen_sim_clear_stats(void)
+{
+    memset(&oxygen_sim.stats, 0, sizeof(oxygen_sim.stats));
+}
+
+void oxygen_sim_reset(void)
+{
+    memset(oxygen_sim.regs, 0, sizeof(oxygen_sim.regs));
+    memset(oxygen_sim.ac97, 0, sizeof(oxygen_sim.ac97));
+    memset(oxygen_sim.cs4398, 0, sizeof(oxygen_sim.cs4398));
+    memset(oxygen_sim.cs4362a, 0, sizeof(oxygen_sim.cs4362a));
+    oxygen_sim.i2c_busy_until = 0;
+    oxygen_sim.ac97_random = oxygen_sim.ac97_seed;
+    oxygen_sim_clear_stats();
+
+    // a port transaction through a PCIe-to-PCI bridge takes about 1 us
+    if (!oxygen_sim.read_ns)
+        oxygen_sim.read_ns = 1000;
+    if (!oxygen_sim.write_ns)
+        oxygen_sim.write_ns = 1000;
+
+    // CMI8788 revision 2 with the CM9780 on AC'97 codec 0, external power on
+    oxygen_sim.regs[OXYGEN_REVISION] = OXYGEN_PACKAGE_ID_8788 |
+                                       OXYGEN_REVISION_2;
+    oxygen_sim.regs[OXYGEN_AC97_CONTROL] = OXYGEN_AC97_CODEC_0;
+    oxygen_sim.regs[OXYGEN_GPI_DATA] = 0x01;
+}
+
+unsigned long oxygen_sim_port_accesses(void)
+{
+    unsigned long total = 0;
+    unsigned int i;
+
+    for (i = 0; i < OXYGEN_SIM_WIDTHS; ++i)
+        total += oxygen_sim.stats.reads[i] + oxygen_sim.stats.writes[i];
+    return total;
+}
+
+static u16 interrupt_mask(void)
+{
+    return oxygen_sim.regs[OXYGEN_INTERRUPT_MASK] |
+           oxygen_sim.regs[OXYGEN_INTERRUPT_MASK + 1] << 8;
+}
+
+static u16 interrupt_status(void)
+{
+    return oxygen_sim.regs[OXYGEN_INTERRUPT_STATUS] |
+           oxygen_sim.regs[OXYGEN_INTERRUPT_STATUS + 1] << 8;
+}
+
+static void set_interrupt_status(u16 status)
+{
+    oxygen_sim.regs[OXYGEN_INTERRUPT_STATUS] = status;
+    oxygen_sim.regs[OXYGEN_INTERRUPT_STATUS + 1] = status >> 8;
+}
+
+void oxygen_sim_raise(u16 status)
+{
+    set_interrupt_status(interrupt_status() | status);
+    if (interrupt_status() & interrupt_mask()) {
+        ++oxygen_sim.stats.irqs;
+        hosted_raise_irq();
+    }
+}
+
+/*
+ * Byte read with the side effects of the real chip.
+ */
+static u8 read_byte(unsigned int offset)
+{
+    u8 value = oxygen_sim.regs[offset];
+
+    switch (offset) {
+    case OXYGEN_2WIRE_BUS_STATUS:
+        if (hosted_clock_ns < oxygen_sim.i2c_busy_until) {
+            value |= OXYGEN_2WIRE_BUSY;
+            ++oxygen_sim.stats.i2c_busy_polls;
+        } else {
+            value &= ~OXYGEN_2WIRE_BUSY;
+        }
+        break;
+    case OXYGEN_AC97_INTERRUPT_STATUS:
+        // reading the status register also clears the bits
+        oxygen_sim.regs[offset] = 0;
+        break;
+    }
+    return value;
+}
+
+static void i2c_write(void)
+{
+    u8 device = oxygen_sim.regs[OXYGEN_2WIRE_CONTROL] &
+                OXYGEN_2WIRE_ADDRESS_MASK;
+    u8 map = oxygen_sim.regs[OXYGEN_2WIRE_MAP];
+    u8 data = oxygen_sim.regs[OXYGEN_2WIRE_DATA];
+    unsigned int khz;
+
+    ++oxygen_sim.stats.i2c_writes;
+    if (device == OXYGEN_SIM_I2C_CS4398 && map < ARRAY_SIZE(oxygen_sim.cs4398))
+        oxygen_sim.cs4398[map] = data;
+    else if (device == OXYGEN_SIM_I2C_CS4362A &&
+             map < ARRAY_SIZE(oxygen_sim.cs4362a))
+        oxygen_sim.cs4362a[map] = data;
+
+    khz = (oxygen_sim.regs[OXYGEN_2WIRE_BUS_STATUS + 1] << 8) &
+          OXYGEN_2WIRE_SPEED_FAST ? 400 : 100;
+    oxygen_sim.i2c_busy_until = hosted_clock_ns +
+                                (u64)I2C_WRITE_BITS * 1000000 / khz;
+}
+
+// xorshift32, from 0..99
+static unsigned int ac97_random_percent(void)
+{
+    u32 x = oxygen_sim.ac97_random ? oxygen_sim.ac97_random : 0x2545f491;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    oxygen_sim.ac97_random = x;
+    return x % 100;
+}
+
+static void ac97_command(void)
+{
+    u32 reg = oxygen_sim.regs[OXYGEN_AC97_REGS] |
+              oxygen_sim.regs[OXYGEN_AC97_REGS + 1] << 8 |
+              oxygen_sim.regs[OXYGEN_AC97_REGS + 2] << 16 |
+              (u32)oxygen_sim.regs[OXYGEN_AC97_REGS + 3] << 24;
+    unsigned int codec = (reg & OXYGEN_AC97_REG_CODEC_MASK) >>
+                         OXYGEN_AC97_REG_CODEC_SHIFT;
+    unsigned int index = (reg & OXYGEN_AC97_REG_ADDR_MASK) >>
+                         OXYGEN_AC97_REG_ADDR_SHIFT;
+    unsigned int failure = 100;
+    u8 done;
+
+    if (oxygen_sim.ac97_failure_rate)
+        failure = ac97_random_percent();
+    if (failure < oxygen_sim.ac97_failure_rate / 2) {
+        ++oxygen_sim.stats.ac97_lost;
+        return;
+    }
+    if (failure < oxygen_sim.ac97_failure_rate)
+        ++oxygen_sim.stats.ac97_dropped;
+    // a dropped read leaves the data bits of the command in the register
+    if (reg & OXYGEN_AC97_REG_DIR_READ) {
+        u16 value = oxygen_sim.ac97[codec][index / 2];
+
+        ++oxygen_sim.stats.ac97_reads;
+        if (failure >= oxygen_sim.ac97_failure_rate) {
+            oxygen_sim.regs[OXYGEN_AC97_REGS] = value;
+            oxygen_sim.regs[OXYGEN_AC97_REGS + 1] = value >> 8;
+        }
+        done = OXYGEN_AC97_INT_READ_DONE;
+    } else {
+        ++oxygen_sim.stats.ac97_writes;
+        if (failure >= oxygen_sim.ac97_failure_rate)
+            oxygen_sim.ac97[codec][index / 2] =
+                reg & OXYGEN_AC97_REG_DATA_MASK;
+        done = OXYGEN_AC97_INT_WRITE_DONE;
+    }
+    oxygen_sim.regs[OXYGEN_AC97_INTERRUPT_STATUS] |= done;
+    if (oxygen_sim.regs[OXYGEN_AC97_INTERRUPT_MASK] & done)
+        oxygen_sim_raise(OXYGEN_INT_AC97);
+}
+
+/*
+ * Side effects of a completed write of the given width.
+ */
+static void after_write(unsigned int offset, unsigned int bytes)
+{
+    unsigned int end = offset + bytes;
+
+    if (offset <= OXYGEN_INTERRUPT_MASK + 1 && end > OXYGEN_INTERRUPT_MASK)
+        // masking an interrupt source acknowledges it
+        set_interrupt_status(interrupt_status() & interrupt_mask());
+    if (offset <= OXYGEN_2WIRE_CONTROL && end > OXYGEN_2WIRE_CONTROL)
+        i2c_write();
+    if (offset <= OXYGEN_AC97_REGS + 3 && end > OXYGEN_AC97_REGS + 3)
+        ac97_command();
+}
+
+static u32 sim_read(unsigned long port, unsigned int bytes)
+{
+    unsigned int offset = port_offset(port, bytes);
+    u32 value = 0;
+    unsigned int i;
+
+    ++oxygen_sim.stats.reads[width_index(bytes)];
+    hosted_clock_advance(oxygen_sim.read_ns);
+    for (i = 0; i < bytes; ++i)
+        value |= (u32)read_byte(offset + i) << (8 * i);
+    return value;
+}
+
+static void sim_write(u32 value, unsigned long port, unsigned int bytes)
+{
+    unsigned int offset = port_offset(port, bytes);
+    unsigned int i;
+
+    ++oxygen_sim.stats.writes[width_index(bytes)];
+    hosted_clock_advance(oxygen_sim.write_ns);
+    for (i = 0; i < bytes; ++i)
+        oxygen_sim.regs[offset + i] = value >> (8 * i);
+    after_write(offset, bytes);
+}
+
+u8 oxygen_sim_in8(unsigned long port)
+{
+    return sim_read(port, 1);
+}
+
+u16 oxygen_sim_in16(unsigned long port)
+{
+    return sim_read(port, 2);
+}
+
+u32 oxygen_sim_in32(unsigned long port)
+{
+    return sim_read(port, 4);
+}
+
+void oxygen_sim_out8(u8 value, unsigned long port)
+{
+    sim_write(value, port, 1);
+}
+
+void oxygen_sim_out16(u16 value, unsigned long port)
+{
+    sim_write(value, port, 2);
+}
+
+void oxygen_sim_out32(u32 value, unsigned long port)
+{
+    sim_write(value, port, 4);
+}
@@ -0,0 +1,134 @@
+//
+// Tests of the AC'97 retry policy against the simulator's failure injection.
+//
+// A write to a trusted codec that is reported done but doesn't reach the codec
+// must not be taken for the codec value: a masked write of the same bits has to
+// repair it.
+//
+// Then, for each failure rate, a few hundred masked updates to six codec 0
+// registers run on a lossy codec bus, after enough clean commands for the
+// codec to be trusted. Then the bus becomes reliable and every register is
+// given its intended value once more with a masked write. Afterwards the codec
+// and oxygen_read_ac97() both have to agree with what the driver was asked to
+// write.
+//
+// Exits with 1 on a mismatch.
+//
+
+#include <hosted/xonar_hosted.h>
+
+#include <stdlib.h>
+
+#include <sound/ac97_codec.h>
+
+#include "main.h"
+
+#define TEST_UPDATES 300
+#define TEST_WARMUP  50
+
+static const unsigned int test_regs[] = {
+        AC97_MASTER, AC97_MIC, AC97_LINE, AC97_CD, AC97_AUX, CM9780_MIXER,
+};
+#define TEST_REGS (sizeof(test_regs) / sizeof(test_regs[0]))
+
+static const unsigned int test_rates[] = { 0, 5, 10, 30 };
+
+static struct xonar *test_probe(void)
+{
+    oxygen_sim.ac97_failure_rate = 0;
+    oxygen_sim.ac97_seed = 1234;
+    oxygen_sim_reset();
+    if (xonar_hosted_probe() < 0) {
+        fprintf(stderr, "probe failed\n");
+        exit(1);
+    }
+    return xonar_hosted_chip();
+}
+
+// makes the class of the register trusted, returns the register value
+static u16 test_warm_up(struct xonar *chip, unsigned int index)
+{
+    u16 value = oxygen_read_ac97(chip, 0, index);
+    unsigned int i;
+
+    for (i = 0; i < TEST_WARMUP; ++i)
+        oxygen_write_ac97(chip, 0, index, value);
+    return value;
+}
+
+static int test_dropped_write(void)
+{
+    struct xonar *chip = test_probe();
+    u16 old = test_warm_up(chip, AC97_MASTER);
+    u16 codec;
+
+    // the write completes, but the codec keeps the old value
+    oxygen_write_ac97_masked(chip, 0, AC97_MASTER, 0x0505, 0x1f1f);
+    oxygen_sim.ac97[0][AC97_MASTER / 2] = old;
+    oxygen_write_ac97_masked(chip, 0, AC97_MASTER, 0x0505, 0x1f1f);
+    codec = oxygen_sim.ac97[0][AC97_MASTER / 2];
+    printf("dropped write: codec %04x, master failures %lu\n", codec,
+           chip->ac97_stats[0][OXYGEN_AC97_CLASS_MIXER].failures);
+    xonar_hosted_remove();
+    if ((codec & 0x1f1f) != 0x0505) {
+        printf("  master: intended %04x\n", (old & ~0x1f1f) | 0x0505);
+        return 1;
+    }
+    return 0;
+}
+
+static int test_rate(unsigned int rate)
+{
+    struct xonar *chip;
+    u16 intended[TEST_REGS];
+    unsigned int i, wrong = 0;
+
+    chip = test_probe();
+    // a codec starts out careful; clean commands make it trusted
+    for (i = 0; i < TEST_REGS; ++i)
+        intended[i] = test_warm_up(chip, test_regs[i]);
+
+    oxygen_sim.ac97_failure_rate = rate;
+    oxygen_sim_clear_stats();
+    for (i = 0; i < TEST_UPDATES; ++i) {
+        unsigned int r = i % TEST_REGS;
+        u16 mask = (i / TEST_REGS) & 1 ? 0x1f00 : 0x001f;
+        u16 data = i * 0x1111;
+
+        intended[r] = (intended[r] & ~mask) | (data & mask);
+        oxygen_write_ac97_masked(chip, 0, test_regs[r], data, mask);
+    }
+    printf("rate %2u%%: ac97 reads %lu writes %lu, lost %lu dropped %lu\n",
+           rate, oxygen_sim.stats.ac97_reads, oxygen_sim.stats.ac97_writes,
+           oxygen_sim.stats.ac97_lost, oxygen_sim.stats.ac97_dropped);
+
+    oxygen_sim.ac97_failure_rate = 0;
+    for (i = 0; i < TEST_REGS; ++i)
+        oxygen_write_ac97_masked(chip, 0, test_regs[i], intended[i], 0xffff);
+    for (i = 0; i < TEST_REGS; ++i) {
+        u16 codec = oxygen_sim.ac97[0][test_regs[i] / 2];
+        u16 read = oxygen_read_ac97(chip, 0, test_regs[i]);
+
+        if (codec != intended[i] || read != intended[i]) {
+            printf("  register %02x: intended %04x, codec %04x, read %04x\n",
+                   test_regs[i], intended[i], codec, read);
+            ++wrong;
+        }
+    }
+
+    xonar_hosted_remove();
+    return wrong ? 1 : 0;
+}
+
+int main(void)
+{
+    unsigned int i;
+    int failed = 0;
+
+    hosted_log_enabled = 0;
+    failed |= test_dropped_write();
+    for (i = 0; i < sizeof(test_rates) / sizeof(test_rates[0]); ++i)
+        failed |= test_rate(test_rates[i]);
+    printf(failed ? "FAIL\n" : "PASS\n");
+    return failed;
+}
@@ -0,0 +1,122 @@
+//
+// Entry points for driving the Xonar driver in the hosted build, see
+// hosted/include/hosted/xonar_hosted.h
+//
+
+#include <hosted/xonar_hosted.h>
+
+#include "main.h"
+
+static struct pci_bus hosted_bus;
+
+static struct pci_dev hosted_pci = {
+        .dev = { .name = "0000:05:04.0" },
+        .bus = &hosted_bus,
+        .vendor = PCI_VENDOR_ID_CMEDIA,
+        .device = PCI_DEV_ID_CM8788,
+        .subsystem_vendor = PCI_VENDOR_ID_ASUS,
+        .subsystem_device = PCI_DEV_ID_XONARDX,
+        .irq = OXYGEN_SIM_IRQ,
+        .resource_start = OXYGEN_SIM_IOPORT,
+        .resource_len = OXYGEN_SIM_IO_SIZE,
+        .resource_flags = IORESOURCE_IO,
+};
+
+int xonar_hosted_probe(void)
+{
+    const struct pci_device_id *id;
+    int err;
+
+    err = hosted_module_init();
+    if (err < 0)
+        return err;
+    id = pci_match_id(hosted_pci_driver->id_table, &hosted_pci);
+    if (!id)
+        return -ENODEV;
+    return hosted_pci_driver->probe(&hosted_pci, id);
+}
+
+void xonar_hosted_remove(void)
+{
+    if (pci_get_drvdata(&hosted_pci))
+        hosted_pci_driver->remove(&hosted_pci);
+    pci_set_drvdata(&hosted_pci, NULL);
+    hosted_module_exit();
+}
+
+struct snd_card *xonar_hosted_card(void)
+{
+    return pci_get_drvdata(&hosted_pci);
+}
+
+void *xonar_hosted_chip(void)
+{
+    struct snd_card *card = xonar_hosted_card();
+
+    return card ? card->private_data : NULL;
+}
+
+struct snd_pcm_substream *xonar_hosted_playback_open(void)
+{
+    struct xonar *chip = xonar_hosted_chip();
+    struct snd_pcm_substream *substream = &chip->pcm->playback;
+
+    memset(&chip->pcm->playback_runtime, 0, sizeof(chip->pcm->playback_runtime));
+    substream->runtime = &chip->pcm->playback_runtime;
+    substream->private_data = chip->pcm->private_data;
+    if (chip->pcm->ops->open(substream) < 0)
+        return NULL;
+    return substream;
+}
+
+int xonar_hosted_hw_params(struct snd_pcm_substream *substream,
+                           unsigned int rate, unsigned int channels,
+                           snd_pcm_format_t format, unsigned int period_bytes,
+                           unsigned int buffer_bytes)
+{
+    struct snd_pcm_runtime *runtime = substream->runtime;
+    struct snd_pcm_hw_params params = {
+            .rate = rate,
+            .channels = channels,
+            .format = format,
+            .period_bytes = period_bytes,
+            .buffer_bytes = buffer_bytes,
+    };
+
+    runtime->rate = rate;
+    runtime->channels = channels;
+    runtime->format = format;
+    runtime->frame_bits = channels * snd_pcm_format_physical_width(format);
+    return substream->pcm->ops->hw_params(substream, &params);
+}
+
+void xonar_hosted_playback_close(struct snd_pcm_substream *substream)
+{
+    if (substream->runtime->dma_area)
+        substream->pcm->ops->hw_free(substream);
+    substream->pcm->ops->close(substream);
+    substream->runtime = NULL;
+}
+
+struct snd_kcontrol *xonar_hosted_control(const char *name)
+{
+    struct snd_card *card = xonar_hosted_card();
+    struct snd_kcontrol *ctl;
+
+    for (ctl = card ? card->controls : NULL; ctl; ctl = ctl->next)
+        if (!strcmp(ctl->id.name, name))
+            return ctl;
+    return NULL;
+}
+
+size_t xonar_hosted_read_proc(char *buf, size_t size)
+{
+    struct snd_card *card = xonar_hosted_card();
+    struct snd_info_buffer buffer = { .buffer = buf, .size = size };
+
+    if (!card || !card->proc || !size)
+        return 0;
+    card->proc->read(card->proc, &buffer);
+    buf[min(buffer.len, size - 1)] = '\0';
+    return buffer.len;
+}
@@ -10,10 +10,14 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/stddef.h>
 #include <linux/init.h>
 #include <linux/delay.h>
+#include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 #include <sound/core.h>
 #include <sound/initval.h>
@@ -52,6 +56,12 @@ MODULE_PARM_DESC(id, "ID string for " CARD_NAME " soundcard.");
 module_param_array(enable, bool, NULL, 0444);
 MODULE_PARM_DESC(enable, "Enable " CARD_NAME " soundcard.");
 
+#ifdef XONAR_IO_BACKENDS
+static char *io_backend = "port";
+module_param(io_backend, charp, 0444);
+MODULE_PARM_DESC(io_backend, "Register access: port, trace or memory.");
+#endif
+
 /* PCI soundcard ID */
 static const struct pci_device_id snd_xonar_id[] =  {
         // device is C-Media(vendor) CMI8788(device): ASUS (subvend) Xonar DX (subdevice)
@@ -81,9 +91,13 @@ static void snd_xonar_free(struct snd_card *card)
     // release irq
     if (chip->irq >= 0)
         free_irq(chip->irq, chip);
-    flush_work(&chip->gpio_work);
+    cancel_delayed_work_sync(&chip->gpio_work);
+    xonar_fade_cancel(chip);
+    flush_work(&chip->i2c_work);
+    cancel_delayed_work_sync(&chip->output_enable_work);
     // destroy mutex
     mutex_destroy(&chip->mutex);
+    mutex_destroy(&chip->scene_mutex);
     // release IO region
     pci_release_regions(chip->pci);
     // disable the PCI entry
@@ -95,13 +109,25 @@ static void snd_xonar_free(struct snd_card *card)
  */
 static void xonar_gpio_changed(struct work_struct *work)
 {
-    struct xonar *chip = container_of(work, struct xonar, gpio_work);
+    struct xonar *chip = container_of(to_delayed_work(work), struct xonar,
+                                      gpio_work);
 
     xonar_ext_power_gpio_changed(chip);
 }
 
+// INTERRUPTS
+
+/*
+ * The interrupt line is shared, and every device on it waits while our
+ * primary handler runs in hard interrupt context. So snd_xonar_interrupt()
+ * only reads the status and masks all interrupts of the chip; masking a
+ * source acknowledges it, and the line is released after these two port
+ * accesses. The interrupt thread unmasks them again under chip->lock and
+ * calls the handler of each source in xonar_irq_sources.
+ */
+
 /**
- * Interrupt handler
+ * Interrupt handler, hard interrupt part
  * @param irq - irq number
  * @param dev_id - chip pointer
  * @return
@@ -109,60 +135,114 @@ static void xonar_gpio_changed(struct work_struct *work)
 static irqreturn_t snd_xonar_interrupt(int irq, void *dev_id)
 {
     struct xonar *chip = dev_id;
+    unsigned int status;
 
-    // read the information whether this chip was interrupted
-    unsigned int status = xonar_read16(chip, OXYGEN_INTERRUPT_STATUS);
+    // straight port accesses: no cache or counters shared with others
+    status = oxygen_io_read(chip, OXYGEN_INTERRUPT_STATUS, 2);
     // if interrupt doesn't relate to this chip than skip handling
     if (!status)
         return IRQ_NONE;
+    oxygen_io_write(chip, OXYGEN_INTERRUPT_MASK, 2, 0);
+    atomic_or(status, &chip->irq_pending);
+    return IRQ_WAKE_THREAD;
+}
 
-    // interrupt handler is atomic so use the spin lock
-    spin_lock(&chip->lock);
-
-    // get only bits which contain proper information
-    unsigned int clear = status & (OXYGEN_CHANNEL_A |
-                      OXYGEN_CHANNEL_B |
-                      OXYGEN_CHANNEL_C |
-                      OXYGEN_CHANNEL_SPDIF |
-                      OXYGEN_CHANNEL_MULTICH |
-                      OXYGEN_CHANNEL_AC97 |
-                      OXYGEN_INT_SPDIF_IN_DETECT |
-                      OXYGEN_INT_GPIO |
-                      OXYGEN_INT_AC97);
-    if (clear) {
-        // spdif is not used
-        if (clear & OXYGEN_INT_SPDIF_IN_DETECT)
-            chip->interrupt_mask &= ~OXYGEN_INT_SPDIF_IN_DETECT;
-        oxygen_write16(chip, OXYGEN_INTERRUPT_MASK,
-                       chip->interrupt_mask & ~clear);
-        oxygen_write16(chip, OXYGEN_INTERRUPT_MASK,
-                       chip->interrupt_mask);
-    }
+// period end of the running stream, make cycle in DMA buffer
+static void xonar_irq_pcm(struct xonar *chip, unsigned int status)
+{
+    if ((status & chip->pcm_running) && chip->substream)
+        snd_pcm_period_elapsed(chip->substream);
+}
+
+// while the work is pending further edges are absorbed by it
+static void xonar_irq_gpio(struct xonar *chip, unsigned int status)
+{
+    schedule_delayed_work(&chip->gpio_work,
+                          msecs_to_jiffies(XONAR_GPIO_DEBOUNCE_MS));
+}
+
+// reading the AC'97 status clears it, so the bits are kept for the waiter
+static void xonar_irq_ac97(struct xonar *chip, unsigned int status)
+{
+    u8 ac97_status;
 
-    /* call updater, unlock before it */
-    spin_unlock(&chip->lock);
+    spin_lock_irq(&chip->lock);
+    ac97_status = xonar_read8(chip, OXYGEN_AC97_INTERRUPT_STATUS);
+    chip->ac97_status |= ac97_status;
+    // the waiter only wants a finished command
+    if (ac97_status & (OXYGEN_AC97_INT_READ_DONE | OXYGEN_AC97_INT_WRITE_DONE))
+        complete(&chip->ac97_completion);
+    spin_unlock_irq(&chip->lock);
+}
 
+static const struct {
+    unsigned int status;
+    void (*handler)(struct xonar *chip, unsigned int status);
+} xonar_irq_sources[] = {
     // most common interrupt is dma buffer end
-    // check if it is the case
-    unsigned int elapsed_streams = status & chip->pcm_running;
-    if (elapsed_streams && chip->substream)
-        // if yes then make cycle in DMA buffer
-        snd_pcm_period_elapsed(chip->substream);
-    spin_lock(&chip->lock);
+    { OXYGEN_CHANNEL_A | OXYGEN_CHANNEL_B | OXYGEN_CHANNEL_C |
+      OXYGEN_CHANNEL_SPDIF | OXYGEN_CHANNEL_MULTICH, xonar_irq_pcm },
+    { OXYGEN_INT_GPIO, xonar_irq_gpio },
+    { OXYGEN_INT_AC97, xonar_irq_ac97 },
+};
 
-    // perform tasks if needed
-    if (status & OXYGEN_INT_GPIO)
-        schedule_work(&chip->gpio_work);
+/**
+ * Interrupt handler, thread part
+ * @param irq - irq number
+ * @param dev_id - chip pointer
+ * @return
+ */
+static irqreturn_t snd_xonar_irq_thread(int irq, void *dev_id)
+{
+    struct xonar *chip = dev_id;
+    unsigned int status = atomic_xchg(&chip->irq_pending, 0);
+    unsigned int i;
 
-    if (status & OXYGEN_INT_AC97)
-        wake_up(&chip->ac97_waitqueue);
+    spin_lock_irq(&chip->lock);
+    // spdif is not used
+    if (status & OXYGEN_INT_SPDIF_IN_DETECT)
+        chip->interrupt_mask &= ~OXYGEN_INT_SPDIF_IN_DETECT;
+    oxygen_write16(chip, OXYGEN_INTERRUPT_MASK, chip->interrupt_mask);
+    spin_unlock_irq(&chip->lock);
 
-    spin_unlock(&chip->lock);
+    for (i = 0; i < ARRAY_SIZE(xonar_irq_sources); ++i)
+        if (status & xonar_irq_sources[i].status)
+            xonar_irq_sources[i].handler(chip,
+                                         status & xonar_irq_sources[i].status);
     return IRQ_HANDLED;
 }
 
 
 static void configure_pcie_bridge(struct pci_dev *pci);
+// init oxygen hardware
+static void oxygen_init(struct xonar *chip);
+#ifdef XONAR_IO_BACKENDS
+// the trace is printed first, before the register dump adds its own reads
+static void xonar_proc_io_trace(struct xonar *chip,
+                                struct snd_info_buffer *buffer)
+{
+    unsigned long n = min_t(unsigned long, chip->io_trace_count,
+                            OXYGEN_IO_TRACE_SIZE);
+    unsigned long k;
+
+    snd_iprintf(buffer, "I/O backend: %s\n", chip->io_ops->name);
+    if (!n)
+        return;
+    // oldest first; entries may be overwritten while this runs
+    snd_iprintf(buffer, "I/O trace, last %lu of %lu accesses:\n",
+                n, chip->io_trace_count);
+    for (k = chip->io_trace_count - n; k < chip->io_trace_count; ++k) {
+        struct oxygen_io_trace_entry *e =
+            &chip->io_trace[k % OXYGEN_IO_TRACE_SIZE];
+
+        snd_iprintf(buffer, "%12llu %s%u %02x %0*x\n",
+                    (unsigned long long)e->ns, e->write ? "out" : "in",
+                    e->bytes * 8, e->reg, e->bytes * 2, e->value);
+    }
+    snd_iprintf(buffer, "\n");
+}
+#endif
+
 static void xonar_proc_read(struct snd_info_entry *entry, struct snd_info_buffer *buffer);
 /**
  * Create/initialize chip specific data.
@@ -179,6 +259,23 @@ static int snd_xonar_create(struct snd_card *card,
 
     chip = card->private_data;
 
+    // the interrupt, trigger and pointer paths use only this cache line;
+    // lock debugging and PREEMPT_RT's rt_mutex based spinlock_t make the
+    // lock too big for it
+#if !defined(CONFIG_DEBUG_SPINLOCK) && !defined(CONFIG_DEBUG_LOCK_ALLOC) && \
+    !defined(CONFIG_PREEMPT_RT)
+    BUILD_BUG_ON(offsetofend(struct xonar, pcm_running) > L1_CACHE_BYTES);
+#endif
+
+#ifdef XONAR_IO_BACKENDS
+    err = oxygen_io_set_backend(chip, io_backend);
+    if (err < 0) {
+        dev_err(card->dev, "unknown io_backend %s\n", io_backend);
+        snd_card_free(card);
+        return err;
+    }
+#endif
+
     /* initialize PCI entry */
     err = pci_enable_device(pci);
     if (err < 0) {
@@ -223,15 +320,21 @@ static int snd_xonar_create(struct snd_card *card,
 
 
     // Allocation for interruption source
-    // arguments are irq line number, interrupt handler, flags (int is shared across PCI devices), module name and
-    // data passed to handler, which is chip specific variable here
-    if (request_irq(pci->irq, snd_xonar_interrupt,
-                    IRQF_SHARED, KBUILD_MODNAME, chip)) {
+    // arguments are irq line number, hard interrupt handler, interrupt thread, flags (int is shared across PCI
+    // devices), module name and data passed to handler, which is chip specific variable here
+    if (request_threaded_irq(pci->irq, snd_xonar_interrupt,
+                             snd_xonar_irq_thread,
+                             IRQF_SHARED, KBUILD_MODNAME, chip)) {
         printk(KERN_ERR "cannot grab irq %d\n", pci->irq);
         snd_card_free(card);
         return -EBUSY;
     }
     chip->irq = pci->irq;
+    // enable the interrupts requested during init (GPIO for external power),
+    // the PCM ones are added when streams run
+    spin_lock_irq(&chip->lock);
+    oxygen_write16(chip, OXYGEN_INTERRUPT_MASK, chip->interrupt_mask);
+    spin_unlock_irq(&chip->lock);
 
     // init pcm stream
     err = snd_xonar_new_pcm(chip);
@@ -262,7 +365,8 @@ static int snd_xonar_create(struct snd_card *card,
 static int snd_xonar_probe(struct pci_dev *pci,
                            const struct pci_device_id *pci_id) {
     static int dev;
-    int err;
+    ktime_t start = ktime_get();
+    int err, i, j;
 
     // Check and increment the device index to find the proper device
     if (dev >= SNDRV_CARDS)
@@ -278,22 +382,41 @@ static int snd_xonar_probe(struct pci_dev *pci,
     struct xonar *chip;
     // Arguments are: parent PCI device, card index and id, module ptr, size of the extra data and variable ptr to be filled
 
+    // one cache line more, the hot block at the start of the chip must be aligned
     err = snd_card_new(&pci->dev, index[dev], id[dev], THIS_MODULE,
-                       sizeof(*chip), &card);
+                       sizeof(*chip) + L1_CACHE_BYTES, &card);
     if (err < 0) {
         return err;
     }
     // attach structures to the chip structure
-    chip = card->private_data;
+    chip = PTR_ALIGN(card->private_data, L1_CACHE_BYTES);
+    card->private_data = chip;
     chip->card = card;
     chip->pci = pci;
+    // no interrupt until snd_xonar_create() requests it
+    chip->irq = -1;
 
     // init spinlock and mutex
     spin_lock_init(&chip->lock);
     mutex_init(&chip->mutex);
-    // initialize ac97 queue which is used on writes to ac97 device, not used as it is input device
-    INIT_WORK(&chip->gpio_work, xonar_gpio_changed);
-    init_waitqueue_head(&chip->ac97_waitqueue);
+    mutex_init(&chip->scene_mutex);
+    spin_lock_init(&chip->i2c_lock);
+    mutex_init(&chip->i2c_mutex);
+    INIT_DELAYED_WORK(&chip->gpio_work, xonar_gpio_changed);
+    // DAC writes from the mixer controls are sent from this work
+    INIT_WORK(&chip->i2c_work, xonar_i2c_work);
+    // speakers are switched on from this work after the anti-pop delay
+    INIT_DELAYED_WORK(&chip->output_enable_work, xonar_output_enable_work);
+    // volume fades are stepped by this timer and work
+    hrtimer_init(&chip->fade_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    chip->fade_timer.function = xonar_fade_timer;
+    INIT_WORK(&chip->fade_work, xonar_fade_work);
+    // AC'97 commands wait on this, the interrupt handler completes it
+    init_completion(&chip->ac97_completion);
+    // the AC'97 retry policy starts out careful, see oxygen_io.c
+    for (i = 0; i < 2; ++i)
+        for (j = 0; j < OXYGEN_AC97_CLASSES; ++j)
+            chip->ac97_stats[i][j].failure_rate = OXYGEN_AC97_RATE_INITIAL;
 
 
     // Create the main component. Look for snd_xonar_create.
@@ -322,6 +445,10 @@ static int snd_xonar_probe(struct pci_dev *pci,
         return err;
     }
 
+    // the output is enabled later, so this is when the card can be used
+    dev_info(card->dev, "registered in %lld us\n",
+             (long long)ktime_to_us(ktime_sub(ktime_get(), start)));
+
     // set the pci driver, pointer used in remove callback and ...
     pci_set_drvdata(pci, card);
     // continue probe for other devices
@@ -336,8 +463,13 @@ static int snd_xonar_probe(struct pci_dev *pci,
  */
 static void snd_xonar_remove(struct pci_dev *pci)
 {
+    struct snd_card *card = pci_get_drvdata(pci);
+
+    // the fade work notifies the volume control, which snd_card_free()
+    // destroys before snd_xonar_free() runs
+    xonar_fade_cancel(card->private_data);
     // free the card structure
-    snd_card_free(pci_get_drvdata(pci));
+    snd_card_free(card);
     // ALSA middle layer will release all the attached components if there were any
 }
 
@@ -357,6 +489,8 @@ static void snd_xonar_shutdown(struct pci_dev *pci) {
 
     // chip specific cleanup
     printk(KERN_ERR "PERFORM XONAR SHUTDOWN");
+    // no more volume steps once the DACs are powered down
+    xonar_fade_cancel(chip);
     // clean up xonar specific data
     xonar_dx_cleanup(chip);
 }
@@ -393,7 +527,10 @@ static void xonar_proc_read(struct snd_info_entry *entry,
     struct xonar *chip = entry->private_data;
     int i, j;
 
-    switch (xonar_read8(chip, OXYGEN_REVISION) & OXYGEN_PACKAGE_ID_MASK) {
+#ifdef XONAR_IO_BACKENDS
+    xonar_proc_io_trace(chip, buffer);
+#endif
+    switch (xonar_read8_uncached(chip, OXYGEN_REVISION) & OXYGEN_PACKAGE_ID_MASK) {
         case OXYGEN_PACKAGE_ID_8786: i = '6'; break;
         case OXYGEN_PACKAGE_ID_8787: i = '7'; break;
         case OXYGEN_PACKAGE_ID_8788: i = '8'; break;
@@ -404,9 +541,54 @@ static void xonar_proc_read(struct snd_info_entry *entry,
     for (i = 0; i < OXYGEN_IO_SIZE; i += 0x10) {
         snd_iprintf(buffer, "%02x:", i);
         for (j = 0; j < 0x10; ++j)
-            snd_iprintf(buffer, " %02x", xonar_read8(chip, i + j));
+            snd_iprintf(buffer, " %02x", xonar_read8_uncached(chip, i + j));
         snd_iprintf(buffer, "\n");
     }
+    // port reads saved by the register cache, out-of-line reads only
+    snd_iprintf(buffer, "\nregister cache (slow path): %lu hits, %lu misses, "
+                "%lu volatile reads\n",
+                chip->io_stats.cache_hits, chip->io_stats.cache_misses,
+                chip->io_stats.volatile_reads);
+    snd_iprintf(buffer, "2-wire: %lu writes, %lu timeouts, "
+                "%llu us waited (max %llu us)\n",
+                chip->io_stats.i2c_writes, chip->io_stats.i2c_timeouts,
+                (unsigned long long)chip->io_stats.i2c_wait_ns / 1000,
+                (unsigned long long)chip->io_stats.i2c_wait_max_ns / 1000);
+    snd_iprintf(buffer, "AC'97: %lu read and %lu write transactions, "
+                "%lu masked writes from the shadow\n",
+                chip->io_stats.ac97_reads, chip->io_stats.ac97_writes,
+                chip->io_stats.ac97_shadow_hits);
+    for (i = 0; i < 2; ++i) {
+        static const char *const class_names[OXYGEN_AC97_CLASSES] = {
+            "mixer", "vendor"
+        };
+        struct oxygen_ac97_stats *stats;
+
+        if (!(i ? chip->has_ac97_1 : chip->has_ac97_0))
+            continue;
+        for (j = 0; j < OXYGEN_AC97_CLASSES; ++j) {
+            stats = &chip->ac97_stats[i][j];
+            snd_iprintf(buffer, "AC'97 codec %d %s registers: %lu commands, "
+                        "%lu attempts, %lu failed, %lu errors, "
+                        "failure rate %u.%u%%\n",
+                        i, class_names[j], stats->commands, stats->attempts,
+                        stats->failures, stats->errors,
+                        stats->failure_rate * 100 / OXYGEN_AC97_RATE_ONE,
+                        stats->failure_rate * 1000 / OXYGEN_AC97_RATE_ONE % 10);
+        }
+        snd_iprintf(buffer, "AC'97 codec %d registers that failed: %016llx\n",
+                    i, (unsigned long long)chip->ac97_suspect[i]);
+    }
+    snd_iprintf(buffer, "Write batching: %lu writes in %lu port writes\n",
+                chip->io_stats.batched_writes,
+                chip->io_stats.batch_port_writes);
+    snd_iprintf(buffer, "Register transactions: %lu commits, %lu writes "
+                        "(%lu unchanged dropped), IRQs off %llu ns (max %llu ns)\n",
+                chip->io_stats.txn_commits,
+                chip->io_stats.txn_writes,
+                chip->io_stats.txn_unchanged,
+                (unsigned long long)chip->io_stats.txn_irqoff_ns,
+                (unsigned long long)chip->io_stats.txn_irqoff_max_ns);
     if (mutex_lock_interruptible(&chip->mutex) < 0)
         return;
     if (chip->has_ac97_1) {
@@ -429,11 +611,14 @@ static void xonar_proc_read(struct snd_info_entry *entry,
 // I removed some unneeded parts and added some comments here.
 static void oxygen_init(struct xonar *chip)
 {
+    struct oxygen_txn txn;
     unsigned int i;
 
     chip->dac_routing = 1;
+    for (i = 0; i < ARRAY_SIZE(chip->dac_sources); ++i)
+        chip->dac_sources[i] = i;   // every DAC plays its own pair
     for (i = 0; i < 8; ++i)
-        chip->dac_volume[i] = 127;      // max volume
+        chip->dac_volume[i] = 255;      // max volume
     chip->dac_mute = 0;         // 0 means not muted
     chip->spdif_playback_enable = 0;
     chip->spdif_bits = OXYGEN_SPDIF_C | OXYGEN_SPDIF_ORIGINAL |
@@ -448,54 +633,58 @@ static void oxygen_init(struct xonar *chip)
     chip->has_ac97_0 = (i & OXYGEN_AC97_CODEC_0) != 0;
     chip->has_ac97_1 = (i & OXYGEN_AC97_CODEC_1) != 0;
 
-    oxygen_write8_masked(chip, OXYGEN_FUNCTION,
-                         OXYGEN_FUNCTION_RESET_CODEC |
-                         OXYGEN_FUNCTION_2WIRE,
-                         OXYGEN_FUNCTION_RESET_CODEC |
-                         OXYGEN_FUNCTION_2WIRE_SPI_MASK |
-                         OXYGEN_FUNCTION_ENABLE_SPI_4_5);
-    oxygen_write8(chip, OXYGEN_DMA_STATUS, 0);
-    oxygen_write8(chip, OXYGEN_DMA_PAUSE, 0);
-    oxygen_write8(chip, OXYGEN_PLAY_CHANNELS,
-                  OXYGEN_PLAY_CHANNELS_4 |
-                  OXYGEN_DMA_A_BURST_8 |
-                  OXYGEN_DMA_MULTICH_BURST_8);
-    oxygen_write16(chip, OXYGEN_INTERRUPT_MASK, 0);
-    oxygen_write8_masked(chip, OXYGEN_MISC,
-                         0,
-                         OXYGEN_MISC_WRITE_PCI_SUBID |
-                         OXYGEN_MISC_REC_C_FROM_SPDIF |
-                         OXYGEN_MISC_REC_B_FROM_AC97 |
-                         OXYGEN_MISC_REC_A_FROM_MULTICH |
-                         OXYGEN_MISC_MIDI);
-    oxygen_write8(chip, OXYGEN_REC_FORMAT,
-                  (OXYGEN_FORMAT_16 << OXYGEN_REC_FORMAT_A_SHIFT) |
-                  (OXYGEN_FORMAT_16 << OXYGEN_REC_FORMAT_B_SHIFT) |
-                  (OXYGEN_FORMAT_16 << OXYGEN_REC_FORMAT_C_SHIFT));
-    oxygen_write8(chip, OXYGEN_PLAY_FORMAT,
-                  (OXYGEN_FORMAT_16 << OXYGEN_SPDIF_FORMAT_SHIFT) |
-                  (OXYGEN_FORMAT_16 << OXYGEN_MULTICH_FORMAT_SHIFT));
-    oxygen_write8(chip, OXYGEN_REC_CHANNELS, OXYGEN_REC_CHANNELS_2_2_2);
-    oxygen_write16(chip, OXYGEN_I2S_MULTICH_FORMAT,
-                   OXYGEN_RATE_44100 |
-                   chip->dac_i2s_format |
-                   OXYGEN_I2S_MCLK(chip->dac_mclks) |
-                   OXYGEN_I2S_BITS_16 |
-                   OXYGEN_I2S_MASTER |
-                   OXYGEN_I2S_BCLK_64);
+    // the DMA, format and I2S registers are adjacent; staged in a
+    // transaction, neighbouring bytes go out in one port write
+    oxygen_txn_begin(chip, &txn);
+    oxygen_txn_write8_masked(&txn, OXYGEN_FUNCTION,
+                             OXYGEN_FUNCTION_RESET_CODEC |
+                             OXYGEN_FUNCTION_2WIRE,
+                             OXYGEN_FUNCTION_RESET_CODEC |
+                             OXYGEN_FUNCTION_2WIRE_SPI_MASK |
+                             OXYGEN_FUNCTION_ENABLE_SPI_4_5);
+    oxygen_txn_write8(&txn, OXYGEN_DMA_STATUS, 0);
+    oxygen_txn_write8(&txn, OXYGEN_DMA_PAUSE, 0);
+    oxygen_txn_write8(&txn, OXYGEN_PLAY_CHANNELS,
+                      OXYGEN_PLAY_CHANNELS_4 |
+                      OXYGEN_DMA_A_BURST_8 |
+                      OXYGEN_DMA_MULTICH_BURST_8);
+    oxygen_txn_write16(&txn, OXYGEN_INTERRUPT_MASK, 0);
+    oxygen_txn_write8_masked(&txn, OXYGEN_MISC,
+                             0,
+                             OXYGEN_MISC_WRITE_PCI_SUBID |
+                             OXYGEN_MISC_REC_C_FROM_SPDIF |
+                             OXYGEN_MISC_REC_B_FROM_AC97 |
+                             OXYGEN_MISC_REC_A_FROM_MULTICH |
+                             OXYGEN_MISC_MIDI);
+    oxygen_txn_write8(&txn, OXYGEN_REC_FORMAT,
+                      (OXYGEN_FORMAT_16 << OXYGEN_REC_FORMAT_A_SHIFT) |
+                      (OXYGEN_FORMAT_16 << OXYGEN_REC_FORMAT_B_SHIFT) |
+                      (OXYGEN_FORMAT_16 << OXYGEN_REC_FORMAT_C_SHIFT));
+    oxygen_txn_write8(&txn, OXYGEN_PLAY_FORMAT,
+                      (OXYGEN_FORMAT_16 << OXYGEN_SPDIF_FORMAT_SHIFT) |
+                      (OXYGEN_FORMAT_16 << OXYGEN_MULTICH_FORMAT_SHIFT));
+    oxygen_txn_write8(&txn, OXYGEN_REC_CHANNELS, OXYGEN_REC_CHANNELS_2_2_2);
+    oxygen_txn_write16(&txn, OXYGEN_I2S_MULTICH_FORMAT,
+                       OXYGEN_RATE_44100 |
+                       chip->dac_i2s_format |
+                       OXYGEN_I2S_MCLK(chip->dac_mclks) |
+                       OXYGEN_I2S_BITS_16 |
+                       OXYGEN_I2S_MASTER |
+                       OXYGEN_I2S_BCLK_64);
 
     // not used
-    oxygen_write16(chip, OXYGEN_I2S_A_FORMAT,
+    oxygen_txn_write16(&txn, OXYGEN_I2S_A_FORMAT,
                        OXYGEN_I2S_MASTER |
                        OXYGEN_I2S_MUTE_MCLK);
     // not used
-    oxygen_write16(chip, OXYGEN_I2S_B_FORMAT,
+    oxygen_txn_write16(&txn, OXYGEN_I2S_B_FORMAT,
                        OXYGEN_I2S_MASTER |
                        OXYGEN_I2S_MUTE_MCLK);
     // not used
-    oxygen_write16(chip, OXYGEN_I2S_C_FORMAT,
+    oxygen_txn_write16(&txn, OXYGEN_I2S_C_FORMAT,
                        OXYGEN_I2S_MASTER |
                        OXYGEN_I2S_MUTE_MCLK);
+    oxygen_txn_commit(&txn);
     // disable spdif_out
     oxygen_clear_bits32(chip, OXYGEN_SPDIF_CONTROL,
                         OXYGEN_SPDIF_OUT_ENABLE |
@@ -515,30 +704,35 @@ static void oxygen_init(struct xonar *chip)
     oxygen_write8(chip, OXYGEN_GPI_INTERRUPT_MASK, 0);
     oxygen_write16(chip, OXYGEN_GPIO_INTERRUPT_MASK, 0);
     // set routing through good outputs
-    oxygen_write16(chip, OXYGEN_PLAY_ROUTING,
-                   OXYGEN_PLAY_MULTICH_I2S_DAC |
-                   OXYGEN_PLAY_SPDIF_SPDIF |
-                   (0 << OXYGEN_PLAY_DAC0_SOURCE_SHIFT) |
-                   (1 << OXYGEN_PLAY_DAC1_SOURCE_SHIFT) |
-                   (2 << OXYGEN_PLAY_DAC2_SOURCE_SHIFT) |
-                   (3 << OXYGEN_PLAY_DAC3_SOURCE_SHIFT));
-    oxygen_write8(chip, OXYGEN_REC_ROUTING,
-                  OXYGEN_REC_A_ROUTE_I2S_ADC_1 |
-                  OXYGEN_REC_B_ROUTE_I2S_ADC_2 |
-                  OXYGEN_REC_C_ROUTE_SPDIF);
-    oxygen_write8(chip, OXYGEN_ADC_MONITOR, 0);
-    oxygen_write8(chip, OXYGEN_A_MONITOR_ROUTING,
-                  (0 << OXYGEN_A_MONITOR_ROUTE_0_SHIFT) |
-                  (1 << OXYGEN_A_MONITOR_ROUTE_1_SHIFT) |
-                  (2 << OXYGEN_A_MONITOR_ROUTE_2_SHIFT) |
-                  (3 << OXYGEN_A_MONITOR_ROUTE_3_SHIFT));
-
-    if (chip->has_ac97_0 | chip->has_ac97_1)
+    oxygen_txn_begin(chip, &txn);
+    oxygen_txn_write16(&txn, OXYGEN_PLAY_ROUTING,
+                       OXYGEN_PLAY_MULTICH_I2S_DAC |
+                       OXYGEN_PLAY_SPDIF_SPDIF |
+                       (0 << OXYGEN_PLAY_DAC0_SOURCE_SHIFT) |
+                       (1 << OXYGEN_PLAY_DAC1_SOURCE_SHIFT) |
+                       (2 << OXYGEN_PLAY_DAC2_SOURCE_SHIFT) |
+                       (3 << OXYGEN_PLAY_DAC3_SOURCE_SHIFT));
+    oxygen_txn_write8(&txn, OXYGEN_REC_ROUTING,
+                      OXYGEN_REC_A_ROUTE_I2S_ADC_1 |
+                      OXYGEN_REC_B_ROUTE_I2S_ADC_2 |
+                      OXYGEN_REC_C_ROUTE_SPDIF);
+    oxygen_txn_write8(&txn, OXYGEN_ADC_MONITOR, 0);
+    oxygen_txn_write8(&txn, OXYGEN_A_MONITOR_ROUTING,
+                      (0 << OXYGEN_A_MONITOR_ROUTE_0_SHIFT) |
+                      (1 << OXYGEN_A_MONITOR_ROUTE_1_SHIFT) |
+                      (2 << OXYGEN_A_MONITOR_ROUTE_2_SHIFT) |
+                      (3 << OXYGEN_A_MONITOR_ROUTE_3_SHIFT));
+    oxygen_txn_commit(&txn);
+
+    if (chip->has_ac97_0 | chip->has_ac97_1) {
         oxygen_write8(chip, OXYGEN_AC97_INTERRUPT_MASK,
                       OXYGEN_AC97_INT_READ_DONE |
                       OXYGEN_AC97_INT_WRITE_DONE);
-    else
+        // codec commands complete through the interrupt once it is requested
+        chip->interrupt_mask |= OXYGEN_INT_AC97;
+    } else {
         oxygen_write8(chip, OXYGEN_AC97_INTERRUPT_MASK, 0);
+    }
     oxygen_write32(chip, OXYGEN_AC97_OUT_CONFIG, 0);
     oxygen_write32(chip, OXYGEN_AC97_IN_CONFIG, 0);
 
@@ -550,32 +744,15 @@ static void oxygen_init(struct xonar *chip)
         oxygen_set_bits16(chip, OXYGEN_AC97_CONTROL,
                           OXYGEN_AC97_NO_CODEC_0);
     } else {
-        oxygen_write_ac97(chip, 0, AC97_RESET, 0);
-        msleep(1);
-        oxygen_ac97_set_bits(chip, 0, CM9780_GPIO_SETUP,
-                             CM9780_GPIO0IO | CM9780_GPIO1IO);
-        oxygen_ac97_set_bits(chip, 0, CM9780_MIXER,
-                             CM9780_BSTSEL | CM9780_STRO_MIC |
-                             CM9780_MIX2FR | CM9780_PCBSW);
-        oxygen_ac97_set_bits(chip, 0, CM9780_JACK,
-                             CM9780_RSOE | CM9780_CBOE |
-                             CM9780_SSOE | CM9780_FROE |
-                             CM9780_MIC2MIC | CM9780_LI2LI);
-        oxygen_write_ac97(chip, 0, AC97_MASTER, 0x0000);
-        oxygen_write_ac97(chip, 0, AC97_PC_BEEP, 0x8000);
-        oxygen_write_ac97(chip, 0, AC97_MIC, 0x8808);
-        oxygen_write_ac97(chip, 0, AC97_LINE, 0x0808);
-        oxygen_write_ac97(chip, 0, AC97_CD, 0x8808);
-        oxygen_write_ac97(chip, 0, AC97_VIDEO, 0x8808);
-        oxygen_write_ac97(chip, 0, AC97_AUX, 0x8808);
-        oxygen_write_ac97(chip, 0, AC97_REC_GAIN, 0x8000);
-        oxygen_write_ac97(chip, 0, AC97_CENTER_LFE_MASTER, 0x8080);
-        oxygen_write_ac97(chip, 0, AC97_SURROUND_MASTER, 0x8080);
-        oxygen_ac97_clear_bits(chip, 0, CM9780_GPIO_STATUS,
-                               CM9780_GPO0);
-        /* power down unused ADCs and DACs */
-        oxygen_ac97_set_bits(chip, 0, AC97_POWERDOWN,
-                             AC97_PD_PR0 | AC97_PD_PR1);
+        /*
+         * Nothing uses the CM9780 until there is a capture path, so instead
+         * of resetting and setting it up, it is powered down: the front
+         * ADCs and DACs, the mixer and the reference voltage, then the
+         * surround, center and LFE DACs. The AC-link stays up.
+         */
+        oxygen_write_ac97(chip, 0, AC97_POWERDOWN,
+                          AC97_PD_PR0 | AC97_PD_PR1 |
+                          AC97_PD_PR2 | AC97_PD_PR3);
         oxygen_ac97_set_bits(chip, 0, AC97_EXTENDED_STATUS,
                              AC97_EA_PRI | AC97_EA_PRJ | AC97_EA_PRK);
     }
@@ -5,6 +5,10 @@
 #ifndef OS_MAIN_H
 #define OS_MAIN_H
 
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
 #include <sound/control.h>
 
 // card name for module parameters
@@ -18,33 +22,161 @@
 #define OXYGEN_INTERRUPT_STATUS		0x46
 #define OXYGEN_IO_SIZE	0x100
 
+// statistics of the write-through register cache in oxygen_io.c
+struct oxygen_io_stats {
+    // reads through oxygen_read_slow() (offsets that aren't constants, cache
+    // misses): served from saved_registers, first accesses to registers that
+    // weren't read or written yet, and volatile registers, which go to the
+    // hardware. The inline fast paths don't count, so the per-period paths
+    // don't write this cache line.
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    unsigned long volatile_reads;
+
+    // 2-wire (I2C) writes, and the time spent waiting for a free bus
+    unsigned long i2c_writes;
+    unsigned long i2c_timeouts;
+    u64 i2c_wait_ns;
+    u64 i2c_wait_max_ns;
+
+    // AC'97 codec bus transactions, retries included, and masked writes
+    // that took the old value from saved_ac97_registers
+    unsigned long ac97_reads;
+    unsigned long ac97_writes;
+    unsigned long ac97_shadow_hits;
+
+    // writes combined by oxygen_txn_commit(), and the port writes that sent them
+    unsigned long batched_writes;
+    unsigned long batch_port_writes;
+
+    // register transactions: commits, writes sent and writes dropped because
+    // the register already had the value, and the time with interrupts off
+    unsigned long txn_commits;
+    unsigned long txn_writes;
+    unsigned long txn_unchanged;
+    u64 txn_irqoff_ns;
+    u64 txn_irqoff_max_ns;
+};
+
+// register classes of the AC'97 retry policy: the standard registers up to
+// 0x5e, and the vendor registers from 0x60 (CM9780 GPIO, jack and mixer)
+#define OXYGEN_AC97_CLASS_MIXER		0
+#define OXYGEN_AC97_CLASS_VENDOR	1
+#define OXYGEN_AC97_CLASSES		2
+
+// failure rates are in 1/OXYGEN_AC97_RATE_ONE; a new codec is assumed to fail
+// as often as the CMI8788 is known to (about 10%) until it proves otherwise
+#define OXYGEN_AC97_RATE_ONE		1024
+#define OXYGEN_AC97_RATE_INITIAL	(OXYGEN_AC97_RATE_ONE / 8)
+
+// per codec and register class, see oxygen_io.c
+struct oxygen_ac97_stats {
+    // reads and writes asked for, and the tries that ended in a success or
+    // a failure (a confirmed write is one try of two commands)
+    unsigned long commands;
+    unsigned long attempts;
+    // attempts that timed out or didn't read back right, commands given up
+    unsigned long failures;
+    unsigned long errors;
+    // failures per attempt, a running average over about 16 attempts
+    unsigned int failure_rate;
+};
+
+#ifdef XONAR_IO_BACKENDS
+struct xonar;
+
+// register access backend, see oxygen_io.c
+struct oxygen_io_ops {
+    const char *name;
+    u32 (*read)(struct xonar *chip, unsigned int reg, unsigned int bytes);
+    void (*write)(struct xonar *chip, unsigned int reg, unsigned int bytes,
+                  u32 value);
+};
+
+// accesses recorded by the "trace" backend
+#define OXYGEN_IO_TRACE_SIZE	256
+
+struct oxygen_io_trace_entry {
+    u64 ns;
+    u32 value;
+    u8 reg;
+    u8 bytes;
+    bool write;
+};
+#endif
+
+// slots of chip->controls, in the order of xonar_playback_controls
+enum xonar_control {
+    XONAR_CTL_VOLUME,
+    XONAR_CTL_MUTE,
+    XONAR_CTL_FRONT_PANEL,
+    // one playback source per DAC, DAC0-DAC3
+    XONAR_CTL_DAC_SOURCE,
+    XONAR_CTL_FADE = XONAR_CTL_DAC_SOURCE + 4,
+    XONAR_CTL_FADE_TIME,
+    XONAR_CTL_SCENE,
+    XONAR_CTL_EXT_POWER,
+    XONAR_CTL_COUNT
+};
+
 // main driver's card struct
 struct xonar {
+    /*
+     * HOT: what the interrupt handler and the trigger and pointer callbacks
+     * use on every period, in one cache line. snd_xonar_create() checks that
+     * the block, up to pcm_running, stays inside it, so only add fields here
+     * that these paths need, before pcm_running. They still touch the
+     * saved_registers line of the registers they write, and the GPIO and AC97
+     * interrupts their work and completion.
+     */
+    unsigned long ioport;
+#ifdef XONAR_IO_BACKENDS
+    const struct oxygen_io_ops *io_ops;
+#endif
+    // only playback substream
+    struct snd_pcm_substream *substream;
+    // general spinlock for e.g. interrupt handler
+    spinlock_t lock;
+    // interrupt mask which may be needed for interrupt handling
+    unsigned int interrupt_mask;
+    // status bits the hard interrupt part passes to the interrupt thread
+    atomic_t irq_pending;
+    // last field of the hot block
+    u8 pcm_running;
+
+    /* COLD: controls, work, the register shadows and the model constants */
     // general PCI structure
     struct pci_dev *pci;
     // sound card structure from ALSA
     struct snd_card *card;
     // data connected with PCM (Pulse-Code Modulation) stream
     struct snd_pcm *pcm;
-    // only playback substream
-    struct snd_pcm_substream *substream;
-    /**
-     * mixer controls TODO update count
-     * 0 - volume
-     * 1 - mute
-     * 2 - front panel switch
-     */
-    struct snd_kcontrol *controls[3];
+    // "Playback Channel Map" control, follows dac_sources
+    struct snd_pcm_chmap *playback_chmap;
+    // mixer controls, indexed by enum xonar_control
+    struct snd_kcontrol *controls[XONAR_CTL_COUNT];
 
-
-    // hardware registers
-    unsigned long ioport;
     // interrupt line number
     int irq;
-    // interrupt mask which may be needed for interrupt handling
-    unsigned int interrupt_mask;
-
-    struct work_struct gpio_work;
+    struct mutex mutex;
+    // serialises the scene control, taken before mutex
+    struct mutex scene_mutex;
+
+    // GPIO interrupts are debounced: the work runs once per XONAR_GPIO_DEBOUNCE_MS
+    struct delayed_work gpio_work;
+    // AC'97 command completion: the interrupt handler collects the done bits
+    // of OXYGEN_AC97_INTERRUPT_STATUS in ac97_status, under chip->lock
+    struct completion ac97_completion;
+    u8 ac97_status;
+
+#ifdef XONAR_IO_BACKENDS
+    // registers of the "memory" backend
+    u8 io_memory[OXYGEN_IO_SIZE];
+    // ring buffer of the "trace" backend, io_trace_count accesses so far
+    struct oxygen_io_trace_entry io_trace[OXYGEN_IO_TRACE_SIZE];
+    unsigned long io_trace_count;
+    spinlock_t io_trace_lock;
+#endif
 
     // hardware oxygen registers
     union {
@@ -52,10 +184,22 @@ struct xonar {
         __le16 _16[OXYGEN_IO_SIZE / 2];
         __le32 _32[OXYGEN_IO_SIZE / 4];
     } saved_registers;
+    // bit per byte of saved_registers which holds the hardware value
+    u32 saved_registers_valid[OXYGEN_IO_SIZE / 32];
+    struct oxygen_io_stats io_stats;
     u16 saved_ac97_registers[2][0x40];
+    // bit per register of saved_ac97_registers which holds the codec value,
+    // and per valid register whose last write was trusted without a read-back
+    u64 saved_ac97_valid[2];
+    u64 saved_ac97_unconfirmed[2];
+    // retry policy: statistics, and a bit per register that has failed
+    struct oxygen_ac97_stats ac97_stats[2][OXYGEN_AC97_CLASSES];
+    u64 ac97_suspect[2];
 
     // hardware xonar elements
     unsigned int anti_pop_delay;
+    // enables the output after anti_pop_delay ms
+    struct delayed_work output_enable_work;
     u16 output_enable_bit;
     u8 ext_power_reg;
     u8 ext_power_int_reg;
@@ -65,26 +209,43 @@ struct xonar {
     u8 cs4398_regs[8];
     // DAC control registers for other outputs
     u8 cs4362a_regs[15];
+    // DAC registers waiting in the I2C queue, bit per register
+    u16 cs4398_dirty;
+    u16 cs4362a_dirty;
+    unsigned long i2c_queued;
+    unsigned long i2c_coalesced;
+    struct work_struct i2c_work;
+    // protects the DAC register arrays, dirty bits and counters above
+    spinlock_t i2c_lock;
+    // held while a DAC register is taken from the queue and sent over the 2-wire bus
+    struct mutex i2c_mutex;
 
     void (*gpio_changed)(struct xonar *chip);
 
-    // general spinlock for e.g. interrupt handler
-    spinlock_t lock;
-    struct mutex mutex;
-
 
     // OXYGEN - don't really know the meaning of things here
     u8 dac_volume[8];
     u8 dac_mute;
     u8 pcm_active;
-    u8 pcm_running;
     u8 dac_routing;
+    // channel pair of the stream played by each DAC (front, surround, center/LFE, back)
+    u8 dac_sources[4];
+    // channels of the configured stream, 0 if there is none
+    u8 play_channels;
+    // volume fade: fade_timer ticks fade_work which steps dac_volume from
+    // fade_from to fade_to over fade_ms, see simple_mixer.c
+    struct hrtimer fade_timer;
+    struct work_struct fade_work;
+    ktime_t fade_start;
+    unsigned int fade_ms;
+    u8 fade_from[8];
+    u8 fade_to[8];
+    bool fade_active;
     u8 spdif_playback_enable;
     u8 has_ac97_0;
     u8 has_ac97_1;
     u32 spdif_bits;
     u32 spdif_pcm_bits;
-    wait_queue_head_t ac97_waitqueue;
 
     // oxygen->model
     size_t model_data_size;
@@ -99,7 +260,7 @@ struct xonar {
     u8 adc_mclks;
     u16 dac_i2s_format;
     u16 adc_i2s_format;
-};
+} ____cacheline_aligned;
 
 // PCM INIT
 int snd_xonar_new_pcm(struct xonar *chip);
@@ -112,22 +273,37 @@ void xonar_dx_init(struct xonar *chip);
 void xonar_dx_cleanup(struct xonar *chip);
 void xonar_d1_resume(struct xonar *chip);
 
+// asynchronous DAC writes, see xonar_hardware.c
+void xonar_i2c_work(struct work_struct *work);
+void xonar_i2c_flush(struct xonar *chip);
+
 // set internal DACs control registers
 void set_cs43xx_params(struct xonar *chip, struct snd_pcm_hw_params *params);
-// and oxygen hardware as well
-static void oxygen_init(struct xonar *chip);
 
 // xonar mixer controls
 void update_xonar_volume(struct xonar *chip);
 void update_xonar_mute(struct xonar *chip);
+void update_xonar_routing(struct xonar *chip);
+u16 xonar_play_routing(struct xonar *chip);
+#define XONAR_PLAY_ROUTING_MASK	(OXYGEN_PLAY_MUTE_MASK | \
+                                 OXYGEN_PLAY_DAC0_SOURCE_MASK | \
+                                 OXYGEN_PLAY_DAC1_SOURCE_MASK | \
+                                 OXYGEN_PLAY_DAC2_SOURCE_MASK | \
+                                 OXYGEN_PLAY_DAC3_SOURCE_MASK)
+void xonar_fade_work(struct work_struct *work);
+enum hrtimer_restart xonar_fade_timer(struct hrtimer *timer);
+void xonar_fade_cancel(struct xonar *chip);
 
 // FOR PROC
 void dump_registers(struct xonar *chip, struct snd_info_buffer *buffer);
 
 // xonar_lib helpers
 #define GPI_EXT_POWER		0x01
+// a flapping power connector is read once in this time
+#define XONAR_GPIO_DEBOUNCE_MS	50
 
 void xonar_enable_output(struct xonar *chip);
+void xonar_output_enable_work(struct work_struct *work);
 void xonar_disable_output(struct xonar *chip);
 void xonar_init_ext_power(struct xonar *chip);
 void xonar_init_cs53x1(struct xonar *chip);
@@ -147,20 +323,57 @@ void xonar_ext_power_gpio_changed(struct xonar *chip);
 
 
 // OXYGEN I/O operations exports
-u8 xonar_read8(struct xonar *chip, unsigned int reg);
-u16 xonar_read16(struct xonar *chip, unsigned int reg);
-u32 xonar_read32(struct xonar *chip, unsigned int reg);
-
-void oxygen_write8(struct xonar *chip, unsigned int reg, u8 value);
-void oxygen_write16(struct xonar *chip, unsigned int reg, u16 value);
-void oxygen_write32(struct xonar *chip, unsigned int reg, u32 value);
-
-void oxygen_write8_masked(struct xonar *chip, unsigned int reg,
-                          u8 value, u8 mask);
-void oxygen_write16_masked(struct xonar *chip, unsigned int reg,
-                           u16 value, u16 mask);
-void oxygen_write32_masked(struct xonar *chip, unsigned int reg,
-                           u32 value, u32 mask);
+#ifdef XONAR_IO_BACKENDS
+// selects "port", "trace" or "memory", -EINVAL for other names
+int oxygen_io_set_backend(struct xonar *chip, const char *name);
+#endif
+
+// register writes staged by a caller and applied together by
+// oxygen_txn_commit() with interrupts disabled once, see oxygen_io.c
+#define OXYGEN_TXN_MAX	16
+
+struct oxygen_txn {
+    struct xonar *chip;
+    unsigned int count;
+    struct {
+        u8 reg;
+        u8 bytes;
+        u32 value;
+    } writes[OXYGEN_TXN_MAX];
+};
+
+void oxygen_txn_begin(struct xonar *chip, struct oxygen_txn *txn);
+void oxygen_txn_write(struct oxygen_txn *txn, unsigned int reg,
+                      unsigned int bytes, u32 value, u32 mask);
+void oxygen_txn_commit(struct oxygen_txn *txn);
+
+static inline void oxygen_txn_write8(struct oxygen_txn *txn,
+                                     unsigned int reg, u8 value) {
+    oxygen_txn_write(txn, reg, 1, value, 0xff);
+}
+static inline void oxygen_txn_write8_masked(struct oxygen_txn *txn,
+                                            unsigned int reg, u8 value, u8 mask) {
+    oxygen_txn_write(txn, reg, 1, value, mask);
+}
+static inline void oxygen_txn_write16(struct oxygen_txn *txn,
+                                      unsigned int reg, u16 value) {
+    oxygen_txn_write(txn, reg, 2, value, 0xffff);
+}
+static inline void oxygen_txn_write16_masked(struct oxygen_txn *txn,
+                                             unsigned int reg, u16 value, u16 mask) {
+    oxygen_txn_write(txn, reg, 2, value, mask);
+}
+static inline void oxygen_txn_write32(struct oxygen_txn *txn,
+                                      unsigned int reg, u32 value) {
+    oxygen_txn_write(txn, reg, 4, value, 0xffffffff);
+}
+static inline void oxygen_txn_write32_masked(struct oxygen_txn *txn,
+                                             unsigned int reg, u32 value, u32 mask) {
+    oxygen_txn_write(txn, reg, 4, value, mask);
+}
+
+// xonar_read8/16/32, oxygen_write8/16/32 and the masked writes
+#include "oxygen_io.h"
 
 static inline void oxygen_set_bits8(struct xonar *chip,
                                     unsigned int reg, u8 value) {
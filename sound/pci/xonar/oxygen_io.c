@@ -11,6 +11,9 @@
 #include <linux/sched.h>
 #include <linux/export.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
+#include <sound/ac97_codec.h>
 #include <sound/core.h>
 #include <sound/mpu401.h>
 
@@ -18,85 +21,387 @@
 #include "main.h"
 
 
-u8 xonar_read8(struct xonar *chip, unsigned int reg)
+// REGISTER CACHE
+
+// the volatile register list and the inline part of the cache are in oxygen_io.h
+
+/*
+ * Returns true if the value of the register can be taken from
+ * saved_registers, and counts the outcome.
+ */
+static bool oxygen_cache_lookup(struct xonar *chip, unsigned int reg,
+				unsigned int bytes)
 {
-	return inb(chip->ioport + reg);
+	if (oxygen_reg_cached(chip, reg, bytes)) {
+		++chip->io_stats.cache_hits;
+		return true;
+	}
+	if (oxygen_reg_volatile(reg))
+		++chip->io_stats.volatile_reads;
+	else
+		++chip->io_stats.cache_misses;
+	return false;
 }
-EXPORT_SYMBOL(xonar_read8);
 
-u16 xonar_read16(struct xonar *chip, unsigned int reg)
+
+// I/O BACKENDS
+
+/*
+ * Built with XONAR_IO_BACKENDS, oxygen_io_read() and oxygen_io_write() in
+ * oxygen_io.h call the chip's oxygen_io_ops, chosen with the io_backend
+ * module parameter:
+ *  "port"   - the same port I/O, through the ops table
+ *  "trace"  - port I/O, and every access is recorded with a timestamp in a
+ *             ring buffer that is shown in the proc file
+ *  "memory" - the registers are kept in memory and the card isn't touched
+ */
+#ifdef XONAR_IO_BACKENDS
+
+static u32 oxygen_port_read_op(struct xonar *chip, unsigned int reg,
+			       unsigned int bytes)
 {
-	return inw(chip->ioport + reg);
+	return oxygen_pio_read(chip, reg, bytes);
 }
-EXPORT_SYMBOL(xonar_read16);
 
-u32 xonar_read32(struct xonar *chip, unsigned int reg)
+static void oxygen_port_write_op(struct xonar *chip, unsigned int reg,
+				 unsigned int bytes, u32 value)
 {
-	return inl(chip->ioport + reg);
+	oxygen_pio_write(chip, reg, bytes, value);
 }
-EXPORT_SYMBOL(xonar_read32);
 
-void oxygen_write8(struct xonar *chip, unsigned int reg, u8 value)
+static void oxygen_io_trace(struct xonar *chip, unsigned int reg,
+			    unsigned int bytes, u32 value, bool write)
 {
-	outb(value, chip->ioport + reg);
-	chip->saved_registers._8[reg] = value;
+	struct oxygen_io_trace_entry *entry;
+	unsigned long flags;
+
+	spin_lock_irqsave(&chip->io_trace_lock, flags);
+	entry = &chip->io_trace[chip->io_trace_count++ % OXYGEN_IO_TRACE_SIZE];
+	entry->ns = ktime_to_ns(ktime_get());
+	entry->value = value;
+	entry->reg = reg;
+	entry->bytes = bytes;
+	entry->write = write;
+	spin_unlock_irqrestore(&chip->io_trace_lock, flags);
 }
-EXPORT_SYMBOL(oxygen_write8);
 
-void oxygen_write16(struct xonar *chip, unsigned int reg, u16 value)
+static u32 oxygen_trace_read_op(struct xonar *chip, unsigned int reg,
+				unsigned int bytes)
 {
-	outw(value, chip->ioport + reg);
-	chip->saved_registers._16[reg / 2] = cpu_to_le16(value);
+	u32 value = oxygen_pio_read(chip, reg, bytes);
+
+	oxygen_io_trace(chip, reg, bytes, value, false);
+	return value;
 }
-EXPORT_SYMBOL(oxygen_write16);
 
-void oxygen_write32(struct xonar *chip, unsigned int reg, u32 value)
+static void oxygen_trace_write_op(struct xonar *chip, unsigned int reg,
+				  unsigned int bytes, u32 value)
 {
-	outl(value, chip->ioport + reg);
-	chip->saved_registers._32[reg / 4] = cpu_to_le32(value);
+	oxygen_pio_write(chip, reg, bytes, value);
+	oxygen_io_trace(chip, reg, bytes, value, true);
 }
-EXPORT_SYMBOL(oxygen_write32);
 
-void oxygen_write8_masked(struct xonar *chip, unsigned int reg,
-                          u8 value, u8 mask)
+// little endian, like the registers of the chip
+static u32 oxygen_memory_read_op(struct xonar *chip, unsigned int reg,
+				 unsigned int bytes)
 {
-    u8 tmp = inb(chip->ioport + reg);
-    tmp &= ~mask;
-    tmp |= value & mask;
-    outb(tmp, chip->ioport + reg);
-    chip->saved_registers._8[reg] = tmp;
+	unsigned int i;
+	u32 value = 0;
+
+	for (i = 0; i < bytes; ++i)
+		value |= (u32)chip->io_memory[reg + i] << (8 * i);
+	return value;
 }
-EXPORT_SYMBOL(oxygen_write8_masked);
 
-void oxygen_write16_masked(struct xonar *chip, unsigned int reg,
-                           u16 value, u16 mask)
+static void oxygen_memory_write_op(struct xonar *chip, unsigned int reg,
+				   unsigned int bytes, u32 value)
 {
-    u16 tmp = inw(chip->ioport + reg);
-    tmp &= ~mask;
-    tmp |= value & mask;
-    outw(tmp, chip->ioport + reg);
-    chip->saved_registers._16[reg / 2] = cpu_to_le16(tmp);
+	unsigned int i;
+
+	for (i = 0; i < bytes; ++i)
+		chip->io_memory[reg + i] = value >> (8 * i);
 }
-EXPORT_SYMBOL(oxygen_write16_masked);
 
-void oxygen_write32_masked(struct xonar *chip, unsigned int reg,
-                           u32 value, u32 mask)
+static const struct oxygen_io_ops oxygen_io_backends[] = {
+	{ "port", oxygen_port_read_op, oxygen_port_write_op },
+	{ "trace", oxygen_trace_read_op, oxygen_trace_write_op },
+	{ "memory", oxygen_memory_read_op, oxygen_memory_write_op },
+};
+
+int oxygen_io_set_backend(struct xonar *chip, const char *name)
 {
-    u32 tmp = inl(chip->ioport + reg);
-    tmp &= ~mask;
-    tmp |= value & mask;
-    outl(tmp, chip->ioport + reg);
-    chip->saved_registers._32[reg / 4] = cpu_to_le32(tmp);
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(oxygen_io_backends); ++i) {
+		if (!strcmp(oxygen_io_backends[i].name, name)) {
+			spin_lock_init(&chip->io_trace_lock);
+			chip->io_trace_count = 0;
+			chip->io_ops = &oxygen_io_backends[i];
+			return 0;
+		}
+	}
+	return -EINVAL;
 }
-EXPORT_SYMBOL(oxygen_write32_masked);
+EXPORT_SYMBOL(oxygen_io_set_backend);
+
+#endif
+
+
+// WRITE BATCHING
+
+/*
+ * oxygen_txn_commit() sends its writes through a struct oxygen_batch on its
+ * stack: consecutive writes to the bytes of one aligned dword are held back
+ * and sent together as one outl, or as outw/outb for the parts that were
+ * written. The window is flushed, in program order, by a write to another
+ * dword, by a second write to a byte that is still pending (pulses like
+ * reset bits stay two writes) and at the end of the commit. saved_registers
+ * is updated at once. Only the commit writes through its batch, so no other
+ * writer can find bytes of it pending.
+ *
+ * Registers whose write starts an action or acknowledges something are
+ * written through; the pending bytes go out before them.
+ */
+struct oxygen_batch {
+	unsigned int reg;
+	u8 pending;
+};
+
+static bool oxygen_reg_write_through(unsigned int reg)
+{
+	switch (reg) {
+	case OXYGEN_DMA_RESET:
+	case OXYGEN_INTERRUPT_MASK ... OXYGEN_INTERRUPT_STATUS + 1:
+	case OXYGEN_EEPROM_CONTROL ... OXYGEN_EEPROM_DATA + 1:
+	case OXYGEN_2WIRE_CONTROL ... OXYGEN_2WIRE_BUS_STATUS + 1:
+	case OXYGEN_SPI_CONTROL ... OXYGEN_SPI_DATA3:
+	case OXYGEN_MPU401 ... OXYGEN_MPU401 + 1:
+	case OXYGEN_MCU_2WIRE_DATA ... OXYGEN_MCU_2WIRE_CONTROL:
+	case OXYGEN_AC97_CONTROL ... OXYGEN_AC97_REGS + 3:
+	case OXYGEN_TEST ... OXYGEN_DMA_FLUSH:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// send bytes of saved_registers to the port in one access
+static void oxygen_port_write(struct xonar *chip, unsigned int reg,
+			      unsigned int bytes)
+{
+	if (bytes == 4)
+		oxygen_io_write(chip, reg, 4,
+				le32_to_cpu(chip->saved_registers._32[reg / 4]));
+	else if (bytes == 2)
+		oxygen_io_write(chip, reg, 2,
+				le16_to_cpu(chip->saved_registers._16[reg / 2]));
+	else
+		oxygen_io_write(chip, reg, 1, chip->saved_registers._8[reg]);
+	++chip->io_stats.batch_port_writes;
+}
+
+static void oxygen_batch_flush(struct xonar *chip, struct oxygen_batch *batch)
+{
+	unsigned int reg = batch->reg;
+	u8 pending = batch->pending;
+	unsigned int i;
+
+	if (!pending)
+		return;
+	batch->pending = 0;
+	if (pending == 0xf) {
+		oxygen_port_write(chip, reg, 4);
+		return;
+	}
+	for (i = 0; i < 4; i += 2) {
+		if (((pending >> i) & 3) == 3) {
+			oxygen_port_write(chip, reg + i, 2);
+		} else {
+			if (pending & (1 << i))
+				oxygen_port_write(chip, reg + i, 1);
+			if (pending & (2 << i))
+				oxygen_port_write(chip, reg + i + 1, 1);
+		}
+	}
+}
+
+static void oxygen_batch_write(struct xonar *chip, struct oxygen_batch *batch,
+			       unsigned int reg, unsigned int bytes, u32 value)
+{
+	u8 bits = ((1u << bytes) - 1) << (reg % 4);
+
+	if (oxygen_reg_write_through(reg)) {
+		oxygen_batch_flush(chip, batch);
+		oxygen_write(chip, reg, bytes, value);
+		return;
+	}
+	if (bytes == 4)
+		chip->saved_registers._32[reg / 4] = cpu_to_le32(value);
+	else if (bytes == 2)
+		chip->saved_registers._16[reg / 2] = cpu_to_le16(value);
+	else
+		chip->saved_registers._8[reg] = value;
+	oxygen_reg_set_valid(chip, reg, bytes);
+	if (batch->pending &&
+	    (batch->reg != (reg & ~3u) || (batch->pending & bits)))
+		oxygen_batch_flush(chip, batch);
+	batch->reg = reg & ~3u;
+	batch->pending |= bits;
+	++chip->io_stats.batched_writes;
+}
+
+
+// REGISTER TRANSACTIONS
+
+/*
+ * A transaction collects register writes in a struct oxygen_txn, usually on
+ * the caller's stack, and applies them in oxygen_txn_commit(). Masked writes
+ * are resolved while staging, against the staged value or saved_registers,
+ * so any port reads for them happen before interrupts are disabled. The
+ * commit then only has to send the values: writes that don't change a
+ * cached register are dropped, the rest go out as one write batch inside a
+ * single chip->lock section.
+ */
+void oxygen_txn_begin(struct xonar *chip, struct oxygen_txn *txn)
+{
+	txn->chip = chip;
+	txn->count = 0;
+}
+EXPORT_SYMBOL(oxygen_txn_begin);
+
+void oxygen_txn_write(struct oxygen_txn *txn, unsigned int reg,
+		      unsigned int bytes, u32 value, u32 mask)
+{
+	struct xonar *chip = txn->chip;
+	unsigned int i;
+	u32 old;
+
+	for (i = 0; i < txn->count; ++i)
+		if (txn->writes[i].reg == reg && txn->writes[i].bytes == bytes)
+			break;
+	if (i < txn->count) {
+		old = txn->writes[i].value;
+	} else {
+		if (WARN_ON(txn->count == OXYGEN_TXN_MAX)) {
+			/* keep the order of the writes, just in two sections */
+			oxygen_txn_commit(txn);
+			i = 0;
+		}
+		if (mask == ~0u >> (32 - 8 * bytes))
+			old = 0;
+		else if (bytes == 4)
+			old = xonar_read32(chip, reg);
+		else if (bytes == 2)
+			old = xonar_read16(chip, reg);
+		else
+			old = xonar_read8(chip, reg);
+		txn->writes[i].reg = reg;
+		txn->writes[i].bytes = bytes;
+		++txn->count;
+	}
+	txn->writes[i].value = (old & ~mask) | (value & mask);
+}
+EXPORT_SYMBOL(oxygen_txn_write);
+
+void oxygen_txn_commit(struct oxygen_txn *txn)
+{
+	struct xonar *chip = txn->chip;
+	struct oxygen_batch batch = { 0 };
+	unsigned long flags;
+	unsigned int i, written = 0;
+	ktime_t start;
+	u64 ns;
+
+	spin_lock_irqsave(&chip->lock, flags);
+	start = ktime_get();
+	for (i = 0; i < txn->count; ++i) {
+		unsigned int reg = txn->writes[i].reg;
+		unsigned int bytes = txn->writes[i].bytes;
+		u32 value = txn->writes[i].value;
+
+		if (oxygen_reg_cached(chip, reg, bytes) &&
+		    oxygen_saved_value(chip, reg, bytes) == value)
+			continue;
+		oxygen_batch_write(chip, &batch, reg, bytes, value);
+		++written;
+	}
+	oxygen_batch_flush(chip, &batch);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	chip->io_stats.txn_commits++;
+	chip->io_stats.txn_writes += written;
+	chip->io_stats.txn_unchanged += txn->count - written;
+	chip->io_stats.txn_irqoff_ns = ns;
+	if (ns > chip->io_stats.txn_irqoff_max_ns)
+		chip->io_stats.txn_irqoff_max_ns = ns;
+	spin_unlock_irqrestore(&chip->lock, flags);
+
+	txn->count = 0;
+}
+EXPORT_SYMBOL(oxygen_txn_commit);
+
+
+// PORT I/O
+
+/*
+ * The accessors are inline in oxygen_io.h; this is the part for cache
+ * misses and for offsets that aren't compile-time constants.
+ */
+u32 oxygen_read_slow(struct xonar *chip, unsigned int reg, unsigned int bytes)
+{
+	if (!oxygen_cache_lookup(chip, reg, bytes)) {
+		u32 value = oxygen_io_read(chip, reg, bytes);
+
+		if (bytes == 4)
+			chip->saved_registers._32[reg / 4] = cpu_to_le32(value);
+		else if (bytes == 2)
+			chip->saved_registers._16[reg / 2] = cpu_to_le16(value);
+		else
+			chip->saved_registers._8[reg] = value;
+		oxygen_reg_set_valid(chip, reg, bytes);
+	}
+	return oxygen_saved_value(chip, reg, bytes);
+}
+EXPORT_SYMBOL(oxygen_read_slow);
 
 
 // I2C
 
+/* a transfer should not need more than about 300 us, even at standard speed */
+#define OXYGEN_2WIRE_TIMEOUT_US	1000
+#define OXYGEN_2WIRE_POLL_US	10
+
+/*
+ * Wait until the previous transfer has left the 2-wire bus.
+ * The wait is done before a transfer and not after it, so the caller can go
+ * on while the bus sends the last byte. All callers hold chip->i2c_mutex, so
+ * the wait sleeps between the polls; the timeout is measured in time because
+ * the sleeps may take longer than asked for.
+ */
+static void oxygen_wait_i2c(struct xonar *chip)
+{
+    ktime_t start = ktime_get();
+    u64 wait_ns;
+
+    while (xonar_read16(chip, OXYGEN_2WIRE_BUS_STATUS) & OXYGEN_2WIRE_BUSY) {
+        if (ktime_to_us(ktime_sub(ktime_get(), start)) >=
+            OXYGEN_2WIRE_TIMEOUT_US) {
+            ++chip->io_stats.i2c_timeouts;
+            dev_err(chip->card->dev, "2-wire bus timeout\n");
+            break;
+        }
+        usleep_range(OXYGEN_2WIRE_POLL_US, 2 * OXYGEN_2WIRE_POLL_US);
+    }
+
+    wait_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    chip->io_stats.i2c_wait_ns += wait_ns;
+    if (wait_ns > chip->io_stats.i2c_wait_max_ns)
+        chip->io_stats.i2c_wait_max_ns = wait_ns;
+}
+
 void oxygen_write_i2c(struct xonar *chip, u8 device, u8 map, u8 data)
 {
-    /* should not need more than about 300 us */
-    msleep(1);
+    oxygen_wait_i2c(chip);
+    ++chip->io_stats.i2c_writes;
 
     oxygen_write8(chip, OXYGEN_2WIRE_MAP, map);
     oxygen_write8(chip, OXYGEN_2WIRE_DATA, data);
@@ -117,89 +422,322 @@ EXPORT_SYMBOL(oxygen_write_i2c);
  * were made by C-Media ...
  */
 
+/*
+ * saved_ac97_registers holds the last value written to or read from each codec
+ * register, so masked writes don't have to read it back over the slow and
+ * unreliable codec bus. Not for registers that the codec changes by itself:
+ * reset, the ready bits of the power-down and extended status registers and
+ * the GPIO inputs. A reset makes all other values unknown again. A write that
+ * was trusted without reading it back is unconfirmed: masked writes build on
+ * it, and writing the whole register repairs it if the codec dropped it, but
+ * one that would be skipped because of it reads the register first.
+ */
+static bool oxygen_ac97_volatile(unsigned int index)
+{
+    switch (index) {
+    case AC97_RESET:
+    case AC97_POWERDOWN:
+    case AC97_EXTENDED_STATUS:
+    case CM9780_GPIO_STATUS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void oxygen_ac97_save(struct xonar *chip, unsigned int codec,
+                             unsigned int index, u16 value)
+{
+    chip->saved_ac97_registers[codec][index / 2] = value;
+    chip->saved_ac97_unconfirmed[codec] &= ~(1ull << (index / 2));
+    if (index == AC97_RESET) {
+        chip->saved_ac97_valid[codec] = 0;
+        chip->saved_ac97_unconfirmed[codec] = 0;
+    } else if (!oxygen_ac97_volatile(index)) {
+        chip->saved_ac97_valid[codec] |= 1ull << (index / 2);
+    }
+}
+
+/*
+ * With the AC'97 interrupt enabled, the interrupt thread latches the done
+ * bits of OXYGEN_AC97_INTERRUPT_STATUS in chip->ac97_status and completes
+ * chip->ac97_completion, so a waiter sleeps without port reads and doesn't
+ * race the handler for the bits, which are cleared by reading. Before the
+ * interrupt is requested (all of oxygen_init()) and after it is masked, the
+ * register is polled.
+ */
+#define OXYGEN_AC97_POLL_US	10
+#define OXYGEN_AC97_POLLS	100
+
+// called before each command is written to OXYGEN_AC97_REGS
+static void oxygen_ac97_arm(struct xonar *chip)
+{
+    spin_lock_irq(&chip->lock);
+    chip->ac97_status = 0;
+    reinit_completion(&chip->ac97_completion);
+    spin_unlock_irq(&chip->lock);
+}
+
 static int oxygen_ac97_wait(struct xonar *chip, unsigned int mask)
 {
+    unsigned int i;
     u8 status = 0;
 
-    /*
-     * Reading the status register also clears the bits, so we have to save
-     * the read bits in status.
-     */
-    wait_event_timeout(chip->ac97_waitqueue,
-                       ({ status |= xonar_read8(chip, OXYGEN_AC97_INTERRUPT_STATUS);
-                           status & mask; }),
-                       msecs_to_jiffies(1) + 1);
-    /*
-     * Check even after a timeout because this function should not require
-     * the AC'97 interrupt to be enabled.
-     */
-    status |= xonar_read8(chip, OXYGEN_AC97_INTERRUPT_STATUS);
+    if (chip->irq >= 0 && (chip->interrupt_mask & OXYGEN_INT_AC97)) {
+        wait_for_completion_timeout(&chip->ac97_completion,
+                                    msecs_to_jiffies(1) + 1);
+        spin_lock_irq(&chip->lock);
+        // a lost interrupt leaves the bits in the register
+        if (!(chip->ac97_status & mask))
+            chip->ac97_status |= xonar_read8(chip,
+                                             OXYGEN_AC97_INTERRUPT_STATUS);
+        status = chip->ac97_status;
+        spin_unlock_irq(&chip->lock);
+    } else {
+        for (i = 0; i < OXYGEN_AC97_POLLS; ++i) {
+            status |= xonar_read8(chip, OXYGEN_AC97_INTERRUPT_STATUS);
+            if (status & mask)
+                break;
+            udelay(OXYGEN_AC97_POLL_US);
+        }
+    }
     return status & mask ? 0 : -EIO;
 }
 
 
+/*
+ * Retry policy. Every attempt is counted as a success or a failure for its
+ * codec and register class (mixer or vendor registers); failure_rate is the
+ * running average of the failures. While it is low, a write is trusted when
+ * the controller reports it done and a read takes the first value; the next
+ * read of the register tells whether such a write was dropped silently, which
+ * counts as a failure. A register
+ * whose class fails more often, or that failed itself, is "careful": writes
+ * are confirmed by reading the register back, instead of sending them twice
+ * blindly, and reads need two matching values. Commands wait before they
+ * are sent only after a failure, longer with every failure; careful registers
+ * also wait before the first one, like all commands did before.
+ */
+#define OXYGEN_AC97_ATTEMPTS		5
+#define OXYGEN_AC97_RATE_CAREFUL	(OXYGEN_AC97_RATE_ONE / 64)
+#define OXYGEN_AC97_DELAY_US		5
+
+static struct oxygen_ac97_stats *oxygen_ac97_stats(struct xonar *chip,
+                                                   unsigned int codec,
+                                                   unsigned int index)
+{
+    return &chip->ac97_stats[codec][index < 0x60 ? OXYGEN_AC97_CLASS_MIXER
+                                                 : OXYGEN_AC97_CLASS_VENDOR];
+}
+
+static bool oxygen_ac97_careful(struct xonar *chip, unsigned int codec,
+                                unsigned int index)
+{
+    return (chip->ac97_suspect[codec] & (1ull << (index / 2))) ||
+           oxygen_ac97_stats(chip, codec, index)->failure_rate >
+           OXYGEN_AC97_RATE_CAREFUL;
+}
+
+// returns the number of failures of the command so far
+static unsigned int oxygen_ac97_account(struct xonar *chip, unsigned int codec,
+                                        unsigned int index, unsigned int failed,
+                                        bool failure)
+{
+    struct oxygen_ac97_stats *stats = oxygen_ac97_stats(chip, codec, index);
+    unsigned int sample = failure ? OXYGEN_AC97_RATE_ONE : 0;
+
+    ++stats->attempts;
+    stats->failure_rate = stats->failure_rate - stats->failure_rate / 16 +
+                          sample / 16;
+    if (!failure)
+        return failed;
+    ++stats->failures;
+    chip->ac97_suspect[codec] |= 1ull << (index / 2);
+    return failed + 1;
+}
+
+// nothing before a trusted register is tried, then 5, 10, 20, 40 us
+static void oxygen_ac97_backoff(unsigned int failed, bool careful)
+{
+    if (failed)
+        udelay(OXYGEN_AC97_DELAY_US << (failed - 1));
+    else if (careful)
+        udelay(OXYGEN_AC97_DELAY_US);
+}
+
+// one command on the codec bus; false if the controller didn't finish it
+static bool oxygen_ac97_command(struct xonar *chip, u32 reg)
+{
+    unsigned int done;
+
+    oxygen_ac97_arm(chip);
+    oxygen_write32(chip, OXYGEN_AC97_REGS, reg);
+    if (reg & OXYGEN_AC97_REG_DIR_READ) {
+        ++chip->io_stats.ac97_reads;
+        done = OXYGEN_AC97_INT_READ_DONE;
+    } else {
+        ++chip->io_stats.ac97_writes;
+        done = OXYGEN_AC97_INT_WRITE_DONE;
+    }
+    return oxygen_ac97_wait(chip, done) >= 0;
+}
+
+static u32 oxygen_ac97_read_reg(unsigned int codec, unsigned int index)
+{
+    /*
+     * The data bits are all set, so a read that doesn't happen leaves 0xffff
+     * in the register, which is then confirmed by a second read.
+     */
+    return 0xffff | index << OXYGEN_AC97_REG_ADDR_SHIFT |
+           OXYGEN_AC97_REG_DIR_READ | codec << OXYGEN_AC97_REG_CODEC_SHIFT;
+}
+
 void oxygen_write_ac97(struct xonar *chip, unsigned int codec,
                        unsigned int index, u16 data)
 {
-    unsigned int count, succeeded;
+    struct oxygen_ac97_stats *stats = oxygen_ac97_stats(chip, codec, index);
+    bool careful = oxygen_ac97_careful(chip, codec, index);
+    unsigned int count, failed = 0, succeeded = 0;
+    unsigned int last_back = UINT_MAX;
     u32 reg;
 
     reg = data;
     reg |= index << OXYGEN_AC97_REG_ADDR_SHIFT;
     reg |= OXYGEN_AC97_REG_DIR_WRITE;
     reg |= codec << OXYGEN_AC97_REG_CODEC_SHIFT;
-    succeeded = 0;
-    for (count = 5; count > 0; --count) {
-        udelay(5);
-        oxygen_write32(chip, OXYGEN_AC97_REGS, reg);
-        /* require two "completed" writes, just to be sure */
-        if (oxygen_ac97_wait(chip, OXYGEN_AC97_INT_WRITE_DONE) >= 0 &&
-            ++succeeded >= 2) {
-            chip->saved_ac97_registers[codec][index / 2] = data;
+    ++stats->commands;
+    for (count = OXYGEN_AC97_ATTEMPTS; count > 0; --count) {
+        u16 back;
+
+        oxygen_ac97_backoff(failed, careful);
+        if (!oxygen_ac97_command(chip, reg)) {
+            failed = oxygen_ac97_account(chip, codec, index, failed, true);
+            continue;
+        }
+        ++succeeded;
+        if (!careful)
+            goto written;
+        /*
+         * The ready bits of the volatile registers don't read back as
+         * written, so for these two "completed" writes have to do.
+         */
+        if (oxygen_ac97_volatile(index)) {
+            if (succeeded >= 2)
+                goto written;
+            continue;
+        }
+        udelay(OXYGEN_AC97_DELAY_US);
+        if (!oxygen_ac97_command(chip, oxygen_ac97_read_reg(codec, index))) {
+            failed = oxygen_ac97_account(chip, codec, index, failed, true);
+            continue;
+        }
+        back = xonar_read16(chip, OXYGEN_AC97_REGS);
+        if (back == data)
+            goto written;
+        failed = oxygen_ac97_account(chip, codec, index, failed, true);
+        /*
+         * The same other value after two completed writes: the codec doesn't
+         * implement some of the bits, and that is what the register holds.
+         */
+        if (back == last_back) {
+            oxygen_ac97_save(chip, codec, index, back);
             return;
         }
+        last_back = back;
     }
+    // the register may or may not have the new value
+    chip->saved_ac97_valid[codec] &= ~(1ull << (index / 2));
+    chip->saved_ac97_unconfirmed[codec] &= ~(1ull << (index / 2));
+    ++stats->errors;
     dev_err(chip->card->dev, "AC'97 write timeout\n");
+    return;
+
+written:
+    oxygen_ac97_account(chip, codec, index, failed, false);
+    // a register that works at once is trusted again
+    if (!failed)
+        chip->ac97_suspect[codec] &= ~(1ull << (index / 2));
+    oxygen_ac97_save(chip, codec, index, data);
+    // only "done", not read back
+    if (!careful && (chip->saved_ac97_valid[codec] & (1ull << (index / 2))))
+        chip->saved_ac97_unconfirmed[codec] |= 1ull << (index / 2);
 }
 EXPORT_SYMBOL(oxygen_write_ac97);
 
 u16 oxygen_read_ac97(struct xonar *chip, unsigned int codec,
                      unsigned int index)
 {
-    unsigned int count;
+    struct oxygen_ac97_stats *stats = oxygen_ac97_stats(chip, codec, index);
+    bool careful = oxygen_ac97_careful(chip, codec, index);
+    unsigned int count, failed = 0;
     unsigned int last_read = UINT_MAX;
-    u32 reg;
+    u32 reg = oxygen_ac97_read_reg(codec, index);
+    u16 value;
 
-    reg = index << OXYGEN_AC97_REG_ADDR_SHIFT;
-    reg |= OXYGEN_AC97_REG_DIR_READ;
-    reg |= codec << OXYGEN_AC97_REG_CODEC_SHIFT;
-    for (count = 5; count > 0; --count) {
-        udelay(5);
-        oxygen_write32(chip, OXYGEN_AC97_REGS, reg);
-        udelay(10);
-        if (oxygen_ac97_wait(chip, OXYGEN_AC97_INT_READ_DONE) >= 0) {
-            u16 value = xonar_read16(chip, OXYGEN_AC97_REGS);
-            /* we require two consecutive reads of the same value */
-            if (value == last_read)
-                return value;
-            last_read = value;
-            /*
-             * Invert the register value bits to make sure that two
-             * consecutive unsuccessful reads do not return the same
-             * value.
-             */
-            reg ^= 0xffff;
+    ++stats->commands;
+    for (count = OXYGEN_AC97_ATTEMPTS; count > 0; --count) {
+        oxygen_ac97_backoff(failed, careful);
+        if (!oxygen_ac97_command(chip, reg)) {
+            failed = oxygen_ac97_account(chip, codec, index, failed, true);
+            continue;
         }
+        value = xonar_read16(chip, OXYGEN_AC97_REGS);
+        /*
+         * A trusted register takes the first value unless it is 0xffff; a
+         * careful one needs two consecutive reads of the same value.
+         */
+        if (value == last_read ||
+            (!careful && last_read == UINT_MAX && value != 0xffff))
+            goto read;
+        if (last_read != UINT_MAX)
+            failed = oxygen_ac97_account(chip, codec, index, failed, true);
+        last_read = value;
+        /*
+         * Invert the register value bits to make sure that two
+         * consecutive unsuccessful reads do not return the same
+         * value.
+         */
+        reg ^= 0xffff;
     }
+    ++stats->errors;
     dev_err(chip->card->dev, "AC'97 read timeout on codec %u\n", codec);
     return 0;
+
+read:
+    // a trusted write that the codec reported done but didn't do
+    if ((chip->saved_ac97_unconfirmed[codec] & (1ull << (index / 2))) &&
+        value != chip->saved_ac97_registers[codec][index / 2])
+        failed = oxygen_ac97_account(chip, codec, index, failed, true);
+    oxygen_ac97_account(chip, codec, index, failed, false);
+    if (!failed)
+        chip->ac97_suspect[codec] &= ~(1ull << (index / 2));
+    oxygen_ac97_save(chip, codec, index, value);
+    return value;
 }
 EXPORT_SYMBOL(oxygen_read_ac97);
 
+// the old value comes from the shadow when it is known
 void oxygen_write_ac97_masked(struct xonar *chip, unsigned int codec,
                               unsigned int index, u16 data, u16 mask)
 {
-    u16 value = oxygen_read_ac97(chip, codec, index);
+    u16 value;
+
+    if (chip->saved_ac97_valid[codec] & (1ull << (index / 2))) {
+        ++chip->io_stats.ac97_shadow_hits;
+        value = chip->saved_ac97_registers[codec][index / 2];
+        // nothing to do if the codec has the value already
+        if ((value & mask) == (data & mask)) {
+            if (!(chip->saved_ac97_unconfirmed[codec] &
+                  (1ull << (index / 2))))
+                return;
+            // the last write may have been dropped
+            value = oxygen_read_ac97(chip, codec, index);
+            if ((value & mask) == (data & mask))
+                return;
+        }
+    } else {
+        value = oxygen_read_ac97(chip, codec, index);
+    }
     value &= ~mask;
     value |= data & mask;
     oxygen_write_ac97(chip, codec, index, value);
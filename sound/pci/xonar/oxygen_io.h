@@ -0,0 +1,267 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef OXYGEN_IO_H_INCLUDED
+#define OXYGEN_IO_H_INCLUDED
+
+/*
+ * Register accessors, included by main.h after struct xonar.
+ *
+ * They are inline so that the accesses of the interrupt handler and the PCM
+ * callbacks, which use constant offsets, compile to the port instruction and
+ * the saved_registers store. Everything that isn't decided at compile time
+ * (cache misses, offsets that aren't constants) goes to
+ * the out-of-line functions in oxygen_io.c.
+ */
+
+#include <linux/build_bug.h>
+#include <linux/io.h>
+#include "oxygen_regs.h"
+
+/* the chip needs naturally aligned accesses inside its I/O range */
+#define OXYGEN_CHECK_REG(reg, bytes) \
+	BUILD_BUG_ON(__builtin_constant_p(reg) && \
+		     ((reg) % (bytes) != 0 || (reg) + (bytes) > OXYGEN_IO_SIZE))
+
+// out of line parts, see oxygen_io.c
+u32 oxygen_read_slow(struct xonar *chip, unsigned int reg, unsigned int bytes);
+
+
+// REGISTER CACHE
+
+/*
+ * saved_registers mirrors every value written to the chip, so reads and the
+ * read part of masked writes don't need a port read, which costs about 1 us
+ * behind a PCIe-to-PCI bridge. This doesn't hold for registers that the
+ * hardware changes by itself (status, DMA position) or that are read-only;
+ * those are volatile and always read from the port.
+ *
+ * The hard interrupt part writes 0 to OXYGEN_INTERRUPT_MASK with a plain port
+ * write. Until the interrupt thread writes chip->interrupt_mask back,
+ * saved_registers holds that value rather than the 0 in the chip.
+ */
+static inline bool oxygen_reg_volatile(unsigned int reg)
+{
+	switch (reg) {
+	/* DMA address and count registers return the current position */
+	case OXYGEN_DMA_A_ADDRESS ... OXYGEN_DMA_AC97_TCOUNT + 1:
+	case OXYGEN_DMA_STATUS:
+	case OXYGEN_INTERRUPT_STATUS ... OXYGEN_INTERRUPT_STATUS + 1:
+	/* S/PDIF sense, lock and rate bits, and the received channel status */
+	case OXYGEN_SPDIF_CONTROL ... OXYGEN_SPDIF_CONTROL + 3:
+	case OXYGEN_SPDIF_INPUT_BITS ... OXYGEN_SPDIF_INPUT_BITS + 3:
+	case OXYGEN_EEPROM_STATUS ... OXYGEN_EEPROM_DATA + 1:
+	case OXYGEN_2WIRE_BUS_STATUS ... OXYGEN_2WIRE_BUS_STATUS + 1:
+	case OXYGEN_SPI_CONTROL:
+	case OXYGEN_MPU401 ... OXYGEN_MPU401 + 1:
+	case OXYGEN_GPI_DATA:
+	case OXYGEN_DEVICE_SENSE:
+	case OXYGEN_MCU_2WIRE_DATA ... OXYGEN_MCU_2WIRE_STATUS:
+	/* codec presence and suspend state are read-only bits */
+	case OXYGEN_AC97_CONTROL ... OXYGEN_AC97_CONTROL + 1:
+	case OXYGEN_AC97_INTERRUPT_STATUS:
+	case OXYGEN_AC97_REGS ... OXYGEN_AC97_REGS + 3:
+	case OXYGEN_TEST:
+	case OXYGEN_CODEC_VERSION ... OXYGEN_OFFSBASE_44K + 2:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* aligned accesses don't cross a word of saved_registers_valid */
+static __always_inline u32 oxygen_reg_valid_bits(unsigned int reg,
+						 unsigned int bytes)
+{
+	return ((1u << bytes) - 1) << (reg % 32);
+}
+
+static __always_inline bool oxygen_reg_cached(struct xonar *chip,
+					      unsigned int reg,
+					      unsigned int bytes)
+{
+	u32 bits = oxygen_reg_valid_bits(reg, bytes);
+	unsigned int i;
+
+	for (i = reg; i < reg + bytes; ++i)
+		if (oxygen_reg_volatile(i))
+			return false;
+	return (chip->saved_registers_valid[reg / 32] & bits) == bits;
+}
+
+static __always_inline void oxygen_reg_set_valid(struct xonar *chip,
+						 unsigned int reg,
+						 unsigned int bytes)
+{
+	chip->saved_registers_valid[reg / 32] |=
+		oxygen_reg_valid_bits(reg, bytes);
+}
+
+static __always_inline u32 oxygen_saved_value(struct xonar *chip,
+					      unsigned int reg,
+					      unsigned int bytes)
+{
+	if (bytes == 4)
+		return le32_to_cpu(chip->saved_registers._32[reg / 4]);
+	else if (bytes == 2)
+		return le16_to_cpu(chip->saved_registers._16[reg / 2]);
+	else
+		return chip->saved_registers._8[reg];
+}
+
+
+// I/O BACKENDS
+
+/*
+ * All port accesses of the driver go through oxygen_io_read() and
+ * oxygen_io_write(). In a normal build these are inb/outb and friends. Built
+ * with XONAR_IO_BACKENDS, they call the chip's oxygen_io_ops, see
+ * oxygen_io.c.
+ */
+static __always_inline u32 oxygen_pio_read(struct xonar *chip,
+					   unsigned int reg,
+					   unsigned int bytes)
+{
+	if (bytes == 4)
+		return inl(chip->ioport + reg);
+	else if (bytes == 2)
+		return inw(chip->ioport + reg);
+	else
+		return inb(chip->ioport + reg);
+}
+
+static __always_inline void oxygen_pio_write(struct xonar *chip,
+					     unsigned int reg,
+					     unsigned int bytes, u32 value)
+{
+	if (bytes == 4)
+		outl(value, chip->ioport + reg);
+	else if (bytes == 2)
+		outw(value, chip->ioport + reg);
+	else
+		outb(value, chip->ioport + reg);
+}
+
+#ifdef XONAR_IO_BACKENDS
+
+static inline u32 oxygen_io_read(struct xonar *chip, unsigned int reg,
+				 unsigned int bytes)
+{
+	return chip->io_ops->read(chip, reg, bytes);
+}
+
+static inline void oxygen_io_write(struct xonar *chip, unsigned int reg,
+				   unsigned int bytes, u32 value)
+{
+	chip->io_ops->write(chip, reg, bytes, value);
+}
+
+#else
+
+// only port I/O is built: no ops table, the accesses are inlined
+#define oxygen_io_read		oxygen_pio_read
+#define oxygen_io_write		oxygen_pio_write
+
+#endif
+
+
+// PORT I/O
+
+static __always_inline u32 oxygen_read(struct xonar *chip, unsigned int reg,
+				       unsigned int bytes)
+{
+	if (!__builtin_constant_p(reg))
+		return oxygen_read_slow(chip, reg, bytes);
+	if (oxygen_reg_volatile(reg))
+		return oxygen_io_read(chip, reg, bytes);
+	if (likely(oxygen_reg_cached(chip, reg, bytes)))
+		return oxygen_saved_value(chip, reg, bytes);
+	return oxygen_read_slow(chip, reg, bytes);
+}
+
+static __always_inline void oxygen_write(struct xonar *chip, unsigned int reg,
+					 unsigned int bytes, u32 value)
+{
+	if (bytes == 4)
+		chip->saved_registers._32[reg / 4] = cpu_to_le32(value);
+	else if (bytes == 2)
+		chip->saved_registers._16[reg / 2] = cpu_to_le16(value);
+	else
+		chip->saved_registers._8[reg] = value;
+	oxygen_reg_set_valid(chip, reg, bytes);
+	oxygen_io_write(chip, reg, bytes, value);
+}
+
+// reads of non-volatile registers are served from saved_registers
+static __always_inline u8 xonar_read8(struct xonar *chip, unsigned int reg)
+{
+	OXYGEN_CHECK_REG(reg, 1);
+	return oxygen_read(chip, reg, 1);
+}
+
+static __always_inline u16 xonar_read16(struct xonar *chip, unsigned int reg)
+{
+	OXYGEN_CHECK_REG(reg, 2);
+	return oxygen_read(chip, reg, 2);
+}
+
+static __always_inline u32 xonar_read32(struct xonar *chip, unsigned int reg)
+{
+	OXYGEN_CHECK_REG(reg, 4);
+	return oxygen_read(chip, reg, 4);
+}
+
+// always read the hardware, e.g. for register dumps
+static inline u8 xonar_read8_uncached(struct xonar *chip, unsigned int reg)
+{
+	return oxygen_io_read(chip, reg, 1);
+}
+
+static __always_inline void oxygen_write8(struct xonar *chip,
+					  unsigned int reg, u8 value)
+{
+	OXYGEN_CHECK_REG(reg, 1);
+	oxygen_write(chip, reg, 1, value);
+}
+
+static __always_inline void oxygen_write16(struct xonar *chip,
+					   unsigned int reg, u16 value)
+{
+	OXYGEN_CHECK_REG(reg, 2);
+	oxygen_write(chip, reg, 2, value);
+}
+
+static __always_inline void oxygen_write32(struct xonar *chip,
+					   unsigned int reg, u32 value)
+{
+	OXYGEN_CHECK_REG(reg, 4);
+	oxygen_write(chip, reg, 4, value);
+}
+
+// masked writes take the old value from the cache when they can
+static __always_inline void oxygen_write8_masked(struct xonar *chip,
+						 unsigned int reg,
+						 u8 value, u8 mask)
+{
+	u8 tmp = xonar_read8(chip, reg);
+
+	oxygen_write8(chip, reg, (tmp & ~mask) | (value & mask));
+}
+
+static __always_inline void oxygen_write16_masked(struct xonar *chip,
+						  unsigned int reg,
+						  u16 value, u16 mask)
+{
+	u16 tmp = xonar_read16(chip, reg);
+
+	oxygen_write16(chip, reg, (tmp & ~mask) | (value & mask));
+}
+
+static __always_inline void oxygen_write32_masked(struct xonar *chip,
+						  unsigned int reg,
+						  u32 value, u32 mask)
+{
+	u32 tmp = xonar_read32(chip, reg);
+
+	oxygen_write32(chip, reg, (tmp & ~mask) | (value & mask));
+}
+
+#endif /* OXYGEN_IO_H_INCLUDED */
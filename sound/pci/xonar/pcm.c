@@ -36,10 +36,20 @@ static struct snd_pcm_hardware snd_xonar_playback_hw = {
                  SNDRV_PCM_INFO_MMAP_VALID |
                  SNDRV_PCM_INFO_PAUSE |
                  SNDRV_PCM_INFO_NO_PERIOD_WAKEUP),
-        .formats =          SNDRV_PCM_FMTBIT_S16_LE,
-        .rates =            SNDRV_PCM_RATE_44100,
-        .rate_min =         44100,
-        .rate_max =         44100,
+        // S32_LE goes to the DACs with its top 24 bits, see the open callback
+        .formats =          SNDRV_PCM_FMTBIT_S16_LE |
+                            SNDRV_PCM_FMTBIT_S32_LE,
+        // every rate of the single, double and quad speed families
+        .rates =            SNDRV_PCM_RATE_32000 |
+                            SNDRV_PCM_RATE_44100 |
+                            SNDRV_PCM_RATE_48000 |
+                            SNDRV_PCM_RATE_64000 |
+                            SNDRV_PCM_RATE_88200 |
+                            SNDRV_PCM_RATE_96000 |
+                            SNDRV_PCM_RATE_176400 |
+                            SNDRV_PCM_RATE_192000,
+        .rate_min =         32000,
+        .rate_max =         192000,
         .channels_min =     2,
         .channels_max =     8,
         .buffer_bytes_max = BUFFER_BYTES_MAX_MULTICH,
@@ -75,6 +85,11 @@ static int snd_xonar_playback_open(struct snd_pcm_substream *substream)
     if (err < 0)
         return err;
 
+    // the DACs resolve 24 bits, the low byte of S32_LE samples is dropped
+    err = snd_pcm_hw_constraint_msbits(runtime, 0, 32, 24);
+    if (err < 0)
+        return err;
+
     // group channels in pairs
     err = snd_pcm_hw_constraint_step(runtime, 0,
                                      SNDRV_PCM_HW_PARAM_CHANNELS,
@@ -103,6 +118,82 @@ static int snd_xonar_playback_close(struct snd_pcm_substream *substream)
     return 0;
 
 }
+/**
+ * Oxygen LRCK setting for the stream rate
+ */
+static unsigned int oxygen_rate(struct snd_pcm_hw_params *hw_params)
+{
+    switch (params_rate(hw_params)) {
+        case 32000:
+            return OXYGEN_RATE_32000;
+        case 44100:
+            return OXYGEN_RATE_44100;
+        default: /* 48000 */
+            return OXYGEN_RATE_48000;
+        case 64000:
+            return OXYGEN_RATE_64000;
+        case 88200:
+            return OXYGEN_RATE_88200;
+        case 96000:
+            return OXYGEN_RATE_96000;
+        case 176400:
+            return OXYGEN_RATE_176400;
+        case 192000:
+            return OXYGEN_RATE_192000;
+    }
+}
+
+/**
+ * DMA sample format: 16-bit or 32-bit words
+ */
+static unsigned int oxygen_format(struct snd_pcm_hw_params *hw_params)
+{
+    if (params_format(hw_params) == SNDRV_PCM_FORMAT_S32_LE)
+        return OXYGEN_FORMAT_32;
+    return OXYGEN_FORMAT_16;
+}
+
+/**
+ * Width of the I2S data words sent to the DACs
+ */
+static unsigned int oxygen_i2s_bits(struct snd_pcm_hw_params *hw_params)
+{
+    if (params_format(hw_params) == SNDRV_PCM_FORMAT_S32_LE)
+        return OXYGEN_I2S_BITS_24;
+    return OXYGEN_I2S_BITS_16;
+}
+
+/**
+ * DMA layout of the multichannel stream for the negotiated channel count
+ */
+static unsigned int oxygen_play_channels(struct snd_pcm_hw_params *hw_params)
+{
+    switch (params_channels(hw_params)) {
+        case 2: return OXYGEN_PLAY_CHANNELS_2;
+        case 4: return OXYGEN_PLAY_CHANNELS_4;
+        case 6: return OXYGEN_PLAY_CHANNELS_6;
+        default: return OXYGEN_PLAY_CHANNELS_8;
+    }
+}
+
+/**
+ * MCLK/LRCK ratio of the DACs for the speed mode (single/double/quad) of the
+ * stream rate; chip->dac_mclks holds one ratio per mode.
+ */
+static unsigned int oxygen_dac_mclk(struct xonar *chip,
+                                    struct snd_pcm_hw_params *hw_params)
+{
+    unsigned int shift;
+
+    if (params_rate(hw_params) <= 48000)
+        shift = 0;
+    else if (params_rate(hw_params) <= 96000)
+        shift = 2;
+    else
+        shift = 4;
+    return OXYGEN_I2S_MCLK(chip->dac_mclks >> shift);
+}
+
 /* hw_params callback */
 static int snd_xonar_pcm_hw_params(struct snd_pcm_substream *substream,
                                    struct snd_pcm_hw_params *hw_params)
@@ -110,61 +201,62 @@ static int snd_xonar_pcm_hw_params(struct snd_pcm_substream *substream,
     int retcode = snd_pcm_lib_malloc_pages(substream,
                                            params_buffer_bytes(hw_params));
     struct xonar *chip = snd_pcm_substream_chip(substream);
+    struct oxygen_txn txn;
+
+    // the register changes are staged first and written together,
+    // so interrupts are disabled only once and only for the port writes
+    mutex_lock(&chip->mutex);
+    oxygen_txn_begin(chip, &txn);
 
     // activate DMA memory for the stream
-    oxygen_write32(chip, OXYGEN_DMA_MULTICH_ADDRESS,
-                   (u32)substream->runtime->dma_addr);
-    oxygen_write16(chip, OXYGEN_DMA_MULTICH_COUNT,
-                   params_buffer_bytes(hw_params) / 4 - 1);
-    oxygen_write16(chip, OXYGEN_DMA_MULTICH_TCOUNT,
-                   params_period_bytes(hw_params) / 4 - 1);
+    oxygen_txn_write32(&txn, OXYGEN_DMA_MULTICH_ADDRESS,
+                       (u32)substream->runtime->dma_addr);
+    oxygen_txn_write16(&txn, OXYGEN_DMA_MULTICH_COUNT,
+                       params_buffer_bytes(hw_params) / 4 - 1);
+    oxygen_txn_write16(&txn, OXYGEN_DMA_MULTICH_TCOUNT,
+                       params_period_bytes(hw_params) / 4 - 1);
 
     // MULTICH
-    mutex_lock(&chip->mutex);
-    spin_lock_irq(&chip->lock);
-    // set play channels at 4
-    oxygen_write8_masked(chip, OXYGEN_PLAY_CHANNELS,
-                         OXYGEN_PLAY_CHANNELS_4,
-                         OXYGEN_PLAY_CHANNELS_MASK);
-    // proper byts format for play (16 bits)
-    oxygen_write8_masked(chip, OXYGEN_PLAY_FORMAT,
-                         OXYGEN_FORMAT_16 << OXYGEN_MULTICH_FORMAT_SHIFT,
-                         OXYGEN_MULTICH_FORMAT_MASK);
-    // set stream details through I2S like stream Hz, left justifies, 16 bits
-    oxygen_write16_masked(chip, OXYGEN_I2S_MULTICH_FORMAT,
-                          OXYGEN_RATE_44100 |
-                          OXYGEN_I2S_FORMAT_LJUST |
-                          OXYGEN_I2S_MCLK(OXYGEN_MCLKS(256, 128, 128)) |
-                          OXYGEN_I2S_BITS_16,
-                          OXYGEN_I2S_RATE_MASK |
-                          OXYGEN_I2S_FORMAT_MASK |
-                          OXYGEN_I2S_MCLK_MASK |
-                          OXYGEN_I2S_BITS_MASK);
+    // set play channels to the stream layout, the DMA reads only those
+    oxygen_txn_write8_masked(&txn, OXYGEN_PLAY_CHANNELS,
+                             oxygen_play_channels(hw_params),
+                             OXYGEN_PLAY_CHANNELS_MASK);
+    // proper byts format for play (16 or 32 bits)
+    oxygen_txn_write8_masked(&txn, OXYGEN_PLAY_FORMAT,
+                             oxygen_format(hw_params) << OXYGEN_MULTICH_FORMAT_SHIFT,
+                             OXYGEN_MULTICH_FORMAT_MASK);
+    // set stream details through I2S like stream Hz, left justifies, 16/24 bits
+    // (left-justified mode of both DACs takes up to 24 bits, so they don't change)
+    oxygen_txn_write16_masked(&txn, OXYGEN_I2S_MULTICH_FORMAT,
+                              oxygen_rate(hw_params) |
+                              chip->dac_i2s_format |
+                              oxygen_dac_mclk(chip, hw_params) |
+                              oxygen_i2s_bits(hw_params),
+                              OXYGEN_I2S_RATE_MASK |
+                              OXYGEN_I2S_FORMAT_MASK |
+                              OXYGEN_I2S_MCLK_MASK |
+                              OXYGEN_I2S_BITS_MASK);
     // disable spdif
-    oxygen_write32(chip, OXYGEN_SPDIF_CONTROL,
-                   xonar_read32(chip, OXYGEN_SPDIF_CONTROL) & ~OXYGEN_SPDIF_OUT_ENABLE);
+    oxygen_txn_write32_masked(&txn, OXYGEN_SPDIF_CONTROL,
+                              0, OXYGEN_SPDIF_OUT_ENABLE);
 
+    // DAC routing means that different channels will go to different outputs of the card,
+    // the sources are chosen with the mixer controls
+    chip->play_channels = params_channels(hw_params);
+    oxygen_txn_write16_masked(&txn, OXYGEN_PLAY_ROUTING,
+                              xonar_play_routing(chip),
+                              XONAR_PLAY_ROUTING_MASK);
 
-    spin_unlock_irq(&chip->lock);
+    oxygen_txn_commit(&txn);
 
     // set dacs hardware parameters
     set_cs43xx_params(chip, hw_params);
 
-    // DAC routing means that different channels will go to different outputs of the card
-    unsigned int reg_value = (0 << OXYGEN_PLAY_DAC0_SOURCE_SHIFT) |
-                            (1 << OXYGEN_PLAY_DAC1_SOURCE_SHIFT) |
-                            (2 << OXYGEN_PLAY_DAC2_SOURCE_SHIFT) |
-                            (3 << OXYGEN_PLAY_DAC3_SOURCE_SHIFT);
-
-    oxygen_write16_masked(chip, OXYGEN_PLAY_ROUTING, reg_value,
-                          OXYGEN_PLAY_DAC0_SOURCE_MASK |
-                          OXYGEN_PLAY_DAC1_SOURCE_MASK |
-                          OXYGEN_PLAY_DAC2_SOURCE_MASK |
-                          OXYGEN_PLAY_DAC3_SOURCE_MASK);
-
-
     mutex_unlock(&chip->mutex);
 
+    // the DACs must be in the new speed mode before the stream starts; this
+    // waits for the bus without holding chip->mutex, so controls stay responsive
+    xonar_i2c_flush(chip);
 
     return retcode;
 }
@@ -288,7 +380,44 @@ static struct snd_pcm_ops snd_xonar_playback_ops = {
 };
 
 
-/* create a single playback 4-channel pcm device */
+/*
+ * Channel map of the open stream, from the DAC sources: each channel gets the
+ * speaker of the first DAC that plays its pair, or NA if no DAC plays it.
+ */
+static int xonar_chmap_get(struct snd_kcontrol *kcontrol,
+                           struct snd_ctl_elem_value *value)
+{
+    // speakers of DAC0-DAC3
+    static const unsigned char positions[4][2] = {
+            { SNDRV_CHMAP_FL, SNDRV_CHMAP_FR },
+            { SNDRV_CHMAP_RL, SNDRV_CHMAP_RR },
+            { SNDRV_CHMAP_FC, SNDRV_CHMAP_LFE },
+            { SNDRV_CHMAP_SL, SNDRV_CHMAP_SR },
+    };
+    struct snd_pcm_chmap *info = kcontrol->private_data;
+    struct xonar *chip = info->private_data;
+    unsigned int channels = 0;
+    unsigned int i, dac;
+
+    for (i = 0; i < info->max_channels; ++i)
+        value->value.integer.value[i] = 0;
+    mutex_lock(&chip->mutex);
+    if (chip->substream && chip->substream->runtime)
+        channels = min(chip->substream->runtime->channels, info->max_channels);
+    for (i = 0; i < channels; ++i) {
+        value->value.integer.value[i] = SNDRV_CHMAP_NA;
+        for (dac = 0; dac < ARRAY_SIZE(chip->dac_sources); ++dac) {
+            if (chip->dac_sources[dac] == i / 2) {
+                value->value.integer.value[i] = positions[dac][i % 2];
+                break;
+            }
+        }
+    }
+    mutex_unlock(&chip->mutex);
+    return 0;
+}
+
+/* create a single playback multichannel pcm device */
 int snd_xonar_new_pcm(struct xonar *chip)
 {
     struct snd_pcm *pcm;
@@ -313,5 +442,17 @@ int snd_xonar_new_pcm(struct xonar *chip)
                                           snd_dma_pci_data(chip->pci),
                                           DEFAULT_BUFFER_BYTES_MULTICH, BUFFER_BYTES_MAX_MULTICH);
 
+    // tell sound servers which slot goes to which jack; the layouts offered
+    // are the standard ones of the default routing, where DAC n plays pair n,
+    // and the map of the open stream follows the DAC source controls
+    err = snd_pcm_add_chmap_ctls(pcm, SNDRV_PCM_STREAM_PLAYBACK,
+                                 snd_pcm_std_chmaps, 8,
+                                 SND_PCM_CHMAP_MASK_2468,
+                                 &chip->playback_chmap);
+    if (err < 0)
+        return err;
+    chip->playback_chmap->private_data = chip;
+    chip->playback_chmap->kctl->get = xonar_chmap_get;
+
     return 0;
 }
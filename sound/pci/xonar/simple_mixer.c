@@ -2,11 +2,17 @@
 // Created by Tomasz Piechocki on 19/12/2020.
 //
 
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <sound/control.h>
 #include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/tlv.h>
 
 #include "main.h"
+#include "oxygen_regs.h"
 
 /**
  * Get information about possible volume settings.
@@ -26,6 +32,19 @@ static int xonar_vol_info(struct snd_kcontrol *ctl,
     return 0;
 }
 
+/**
+ * Volume level as the DAC of the channel plays it. Channels 2-7 are on the
+ * CS4362A, which has 1 dB steps only, so a 0.5 dB level there goes down to
+ * the next whole dB and the control shows what is played.
+ */
+static u8 xonar_vol_step(unsigned int channel, long volume)
+{
+    // 255 is 0 dB, so the whole dB levels are the odd ones
+    if (channel >= 2 && !(volume & 1))
+        return volume - 1;
+    return volume;
+}
+
 /**
  * Get current volume level
  */
@@ -56,14 +75,19 @@ static int xonar_vol_put(struct snd_kcontrol *ctl,
 
     changed = 0;
     mutex_lock(&chip->mutex);
+    // a direct volume change takes over from a running fade
+    chip->fade_active = false;
     // for each channel
-    for (i = 0; i < chip->dac_channels_mixer; ++i)
+    for (i = 0; i < chip->dac_channels_mixer; ++i) {
+        u8 volume = xonar_vol_step(i, value->value.integer.value[i]);
+
         // check if new value is different from the old one
-        if (value->value.integer.value[i] != chip->dac_volume[i]) {
+        if (volume != chip->dac_volume[i]) {
             // if changed then change volume and set the flag
-            chip->dac_volume[i] = value->value.integer.value[i];
+            chip->dac_volume[i] = volume;
             changed = 1;
         }
+    }
     // update hardware registers if there were changes to volume levels
     if (changed)
         update_xonar_volume(chip);
@@ -108,17 +132,414 @@ static int xonar_mute_put(struct snd_kcontrol *ctl,
     return changed;
 }
 
+/**
+ * Get names of the stream channel pairs a DAC can play
+ */
+static int xonar_dac_source_info(struct snd_kcontrol *ctl,
+                                 struct snd_ctl_elem_info *info)
+{
+    static const char *const names[] = {
+            "Front", "Surround", "Center/LFE", "Back"
+    };
+
+    return snd_ctl_enum_info(info, 1, ARRAY_SIZE(names), names);
+}
+
+/**
+ * Get the channel pair played by the DAC from private_value
+ */
+static int xonar_dac_source_get(struct snd_kcontrol *ctl,
+                                struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+
+    mutex_lock(&chip->mutex);
+    value->value.enumerated.item[0] = chip->dac_sources[ctl->private_value];
+    mutex_unlock(&chip->mutex);
+    return 0;
+}
+
+// the channel map is built from the DAC sources, see pcm.c
+static void xonar_notify_chmap(struct xonar *chip)
+{
+    if (chip->playback_chmap)
+        snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &chip->playback_chmap->kctl->id);
+}
+
+/**
+ * Set the channel pair played by the DAC, it's applied also during playback
+ */
+static int xonar_dac_source_put(struct snd_kcontrol *ctl,
+                                struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+    unsigned int source = value->value.enumerated.item[0];
+    int changed;
+
+    if (source > 3)
+        return -EINVAL;
+    mutex_lock(&chip->mutex);
+    changed = source != chip->dac_sources[ctl->private_value];
+    if (changed) {
+        chip->dac_sources[ctl->private_value] = source;
+        update_xonar_routing(chip);
+    }
+    mutex_unlock(&chip->mutex);
+    if (changed)
+        xonar_notify_chmap(chip);
+    return changed;
+}
+
+#define XONAR_DAC_SOURCE(xname, dac) { \
+        .iface = SNDRV_CTL_ELEM_IFACE_MIXER, \
+        .name = xname, \
+        .info = xonar_dac_source_info, \
+        .get = xonar_dac_source_get, \
+        .put = xonar_dac_source_put, \
+        .private_value = dac, \
+}
+
+// volume levels are 0.5 dB apart, the lowest one is -60 dB; the CS4362A
+// channels only take every other level, see xonar_vol_step()
+static const DECLARE_TLV_DB_SCALE(xonar_db_scale, -6000, 50, 0);
+
+/*
+ * VOLUME FADES
+ *
+ * Writing the fade targets starts a fade from the current levels over the fade
+ * time. fade_timer ticks every XONAR_FADE_STEP_MS and wakes fade_work, which
+ * moves dac_volume along a straight line in dB and queues the attenuation
+ * registers. Both DACs have soft ramp and zero-cross enabled, so they smooth
+ * the steps between the ticks themselves.
+ */
+#define XONAR_FADE_STEP_MS	10
+#define XONAR_FADE_MAX_MS	10000
+
+void xonar_fade_work(struct work_struct *work)
+{
+    struct xonar *chip = container_of(work, struct xonar, fade_work);
+    unsigned int elapsed, i;
+    bool done;
+
+    mutex_lock(&chip->mutex);
+    if (!chip->fade_active) {
+        mutex_unlock(&chip->mutex);
+        return;
+    }
+    elapsed = min_t(s64, ktime_to_ms(ktime_sub(ktime_get(), chip->fade_start)),
+                    chip->fade_ms);
+    done = elapsed >= chip->fade_ms;
+    for (i = 0; i < chip->dac_channels_mixer; ++i) {
+        int from = chip->fade_from[i];
+        int to = chip->fade_to[i];
+        int level = from + (to - from) * (int)elapsed / (int)chip->fade_ms;
+
+        chip->dac_volume[i] = done ? to : xonar_vol_step(i, level);
+    }
+    update_xonar_volume(chip);
+    if (done)
+        chip->fade_active = false;
+    mutex_unlock(&chip->mutex);
+
+    // the volume control changed without a write from user space
+    if (chip->controls[XONAR_CTL_VOLUME])
+        snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &chip->controls[XONAR_CTL_VOLUME]->id);
+}
+
+enum hrtimer_restart xonar_fade_timer(struct hrtimer *timer)
+{
+    struct xonar *chip = container_of(timer, struct xonar, fade_timer);
+
+    // I2C needs process context, the timer only keeps the pace
+    if (!READ_ONCE(chip->fade_active))
+        return HRTIMER_NORESTART;
+    schedule_work(&chip->fade_work);
+    hrtimer_forward_now(timer, ms_to_ktime(XONAR_FADE_STEP_MS));
+    return HRTIMER_RESTART;
+}
+
+/**
+ * Stop a running fade, the volume stays where it got to
+ */
+void xonar_fade_cancel(struct xonar *chip)
+{
+    mutex_lock(&chip->mutex);
+    chip->fade_active = false;
+    mutex_unlock(&chip->mutex);
+    hrtimer_cancel(&chip->fade_timer);
+    cancel_work_sync(&chip->fade_work);
+}
+
+/**
+ * Get the levels of the last fade
+ */
+static int xonar_fade_get(struct snd_kcontrol *ctl,
+                          struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+    unsigned int i;
+
+    mutex_lock(&chip->mutex);
+    for (i = 0; i < chip->dac_channels_mixer; ++i)
+        value->value.integer.value[i] = chip->fade_to[i];
+    mutex_unlock(&chip->mutex);
+    return 0;
+}
+
+/**
+ * Start fading every channel to the given level
+ */
+static int xonar_fade_put(struct snd_kcontrol *ctl,
+                          struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+    unsigned int i;
+    int changed = 0;
+
+    for (i = 0; i < chip->dac_channels_mixer; ++i)
+        if (value->value.integer.value[i] < chip->dac_volume_min ||
+            value->value.integer.value[i] > chip->dac_volume_max)
+            return -EINVAL;
+
+    mutex_lock(&chip->mutex);
+    for (i = 0; i < chip->dac_channels_mixer; ++i) {
+        u8 volume = xonar_vol_step(i, value->value.integer.value[i]);
+
+        if (volume != chip->fade_to[i])
+            changed = 1;
+        chip->fade_from[i] = chip->dac_volume[i];
+        chip->fade_to[i] = volume;
+    }
+    if (chip->fade_ms) {
+        chip->fade_start = ktime_get();
+        chip->fade_active = true;
+        hrtimer_start(&chip->fade_timer, ms_to_ktime(XONAR_FADE_STEP_MS),
+                      HRTIMER_MODE_REL);
+    } else {
+        // no fade time, jump to the levels
+        chip->fade_active = false;
+        for (i = 0; i < chip->dac_channels_mixer; ++i)
+            chip->dac_volume[i] = chip->fade_to[i];
+        update_xonar_volume(chip);
+    }
+    mutex_unlock(&chip->mutex);
+
+    if (!chip->fade_ms)
+        snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &chip->controls[XONAR_CTL_VOLUME]->id);
+    return changed;
+}
+
+/**
+ * Get information about possible fade times
+ */
+static int xonar_fade_time_info(struct snd_kcontrol *ctl,
+                                struct snd_ctl_elem_info *info)
+{
+    info->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+    info->count = 1;
+    info->value.integer.min = 0;
+    info->value.integer.max = XONAR_FADE_MAX_MS;
+    return 0;
+}
+
+/**
+ * Get the fade time in milliseconds
+ */
+static int xonar_fade_time_get(struct snd_kcontrol *ctl,
+                               struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+
+    mutex_lock(&chip->mutex);
+    value->value.integer.value[0] = chip->fade_ms;
+    mutex_unlock(&chip->mutex);
+    return 0;
+}
+
+/**
+ * Set the fade time used by the next fade
+ */
+static int xonar_fade_time_put(struct snd_kcontrol *ctl,
+                               struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+    long ms = value->value.integer.value[0];
+    int changed;
+
+    if (ms < 0 || ms > XONAR_FADE_MAX_MS)
+        return -EINVAL;
+    mutex_lock(&chip->mutex);
+    changed = ms != chip->fade_ms;
+    chip->fade_ms = ms;
+    mutex_unlock(&chip->mutex);
+    return changed;
+}
+
+/**
+ * Get the state of the external power connector, updated from the GPIO work
+ */
+static int xonar_ext_power_get(struct snd_kcontrol *ctl,
+                               struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+
+    value->value.integer.value[0] = READ_ONCE(chip->has_power);
+    return 0;
+}
+
 #define GPIO_D1_FRONT_PANEL	0x0002
+
+/*
+ * MIXER SCENE
+ *
+ * The "Xonar Scene" bytes control holds the whole mixer state, so a preset is
+ * switched with one write. Only what differs from the current state is applied,
+ * and the DAC registers go through the I2C queue, which skips registers
+ * whose value doesn't change.
+ */
+struct xonar_scene {
+    u8 volume[8];       // like "Xonar Volume"
+    u8 mute;            // 1 mutes all outputs (inverse of "Xonar Mute Switch")
+    u8 front_panel;     // like "Front Panel Playback Switch"
+    u8 dac_sources[4];  // like the "... Playback Source" controls
+};
+
+static int xonar_scene_info(struct snd_kcontrol *ctl,
+                            struct snd_ctl_elem_info *info)
+{
+    info->type = SNDRV_CTL_ELEM_TYPE_BYTES;
+    info->count = sizeof(struct xonar_scene);
+    return 0;
+}
+
+static int xonar_scene_get(struct snd_kcontrol *ctl,
+                           struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+    struct xonar_scene scene;
+    unsigned int i;
+
+    mutex_lock(&chip->mutex);
+    for (i = 0; i < ARRAY_SIZE(scene.volume); ++i)
+        scene.volume[i] = chip->dac_volume[i];
+    scene.mute = chip->dac_mute;
+    scene.front_panel = !!(xonar_read16(chip, OXYGEN_GPIO_DATA) &
+                           GPIO_D1_FRONT_PANEL);
+    for (i = 0; i < ARRAY_SIZE(scene.dac_sources); ++i)
+        scene.dac_sources[i] = chip->dac_sources[i];
+    mutex_unlock(&chip->mutex);
+    memcpy(value->value.bytes.data, &scene, sizeof(scene));
+    return 0;
+}
+
+/**
+ * Apply a scene: muting goes on the bus first and unmuting last, so the
+ * outputs never play a half-applied scene. Each step changes the state under
+ * chip->mutex and waits for the bus after dropping it, so other controls and
+ * the fade aren't held up by the bus; chip->scene_mutex keeps two scenes from
+ * interleaving.
+ */
+static int xonar_scene_put(struct snd_kcontrol *ctl,
+                           struct snd_ctl_elem_value *value)
+{
+    struct xonar *chip = ctl->private_data;
+    struct xonar_scene scene;
+    bool volume_changed = false, mute_changed, panel_changed;
+    unsigned int sources_changed = 0;
+    unsigned int i;
+    u16 gpio;
+
+    memcpy(&scene, value->value.bytes.data, sizeof(scene));
+    for (i = 0; i < ARRAY_SIZE(scene.volume); ++i)
+        if (scene.volume[i] < chip->dac_volume_min ||
+            scene.volume[i] > chip->dac_volume_max)
+            return -EINVAL;
+    for (i = 0; i < ARRAY_SIZE(scene.dac_sources); ++i)
+        if (scene.dac_sources[i] > 3)
+            return -EINVAL;
+    if (scene.mute > 1 || scene.front_panel > 1)
+        return -EINVAL;
+
+    mutex_lock(&chip->scene_mutex);
+    mutex_lock(&chip->mutex);
+    // a scene replaces a running fade
+    chip->fade_active = false;
+    mute_changed = scene.mute != chip->dac_mute;
+    if (mute_changed && scene.mute) {
+        chip->dac_mute = 1;
+        update_xonar_mute(chip);
+        mutex_unlock(&chip->mutex);
+        xonar_i2c_flush(chip);
+        mutex_lock(&chip->mutex);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(scene.volume); ++i) {
+        u8 volume = xonar_vol_step(i, scene.volume[i]);
+
+        if (volume != chip->dac_volume[i])
+            volume_changed = true;
+        chip->dac_volume[i] = volume;
+    }
+    for (i = 0; i < ARRAY_SIZE(scene.dac_sources); ++i) {
+        if (scene.dac_sources[i] != chip->dac_sources[i])
+            sources_changed |= 1 << i;
+        chip->dac_sources[i] = scene.dac_sources[i];
+    }
+    if (volume_changed)
+        update_xonar_volume(chip);
+    if (sources_changed)
+        update_xonar_routing(chip);
+    spin_lock_irq(&chip->lock);
+    gpio = xonar_read16(chip, OXYGEN_GPIO_DATA);
+    panel_changed = !!(gpio & GPIO_D1_FRONT_PANEL) != scene.front_panel;
+    if (panel_changed)
+        oxygen_write16(chip, OXYGEN_GPIO_DATA, gpio ^ GPIO_D1_FRONT_PANEL);
+    spin_unlock_irq(&chip->lock);
+    mutex_unlock(&chip->mutex);
+    xonar_i2c_flush(chip);
+
+    if (mute_changed && !scene.mute) {
+        mutex_lock(&chip->mutex);
+        chip->dac_mute = 0;
+        update_xonar_mute(chip);
+        mutex_unlock(&chip->mutex);
+        xonar_i2c_flush(chip);
+    }
+    mutex_unlock(&chip->scene_mutex);
+
+    // the single controls changed without a write to them
+    if (volume_changed)
+        snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &chip->controls[XONAR_CTL_VOLUME]->id);
+    if (mute_changed)
+        snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &chip->controls[XONAR_CTL_MUTE]->id);
+    if (panel_changed)
+        snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                       &chip->controls[XONAR_CTL_FRONT_PANEL]->id);
+    for (i = 0; i < ARRAY_SIZE(scene.dac_sources); ++i)
+        if (sources_changed & (1 << i))
+            snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+                           &chip->controls[XONAR_CTL_DAC_SOURCE + i]->id);
+    if (sources_changed)
+        xonar_notify_chmap(chip);
+    return volume_changed || mute_changed || sources_changed || panel_changed;
+}
 /* Entry points for the playback mixer controls */
 static struct snd_kcontrol_new xonar_playback_controls[] = {
         {
                 .iface = SNDRV_CTL_ELEM_IFACE_MIXER,
                 /* Control is of type MIXER */
                 .name = "Xonar Volume", /* Name */
-                .access = SNDRV_CTL_ELEM_ACCESS_READWRITE,
+                .access = SNDRV_CTL_ELEM_ACCESS_READWRITE |
+                          SNDRV_CTL_ELEM_ACCESS_TLV_READ,
                 .info = xonar_vol_info, /* Volume info */
                 .get = xonar_vol_get, /* Get volume */
                 .put = xonar_vol_put, /* Set volume */
+                .tlv = { .p = xonar_db_scale }, /* dB range */
         },
         // boolean controls don't need custom info function
         {
@@ -136,7 +557,46 @@ static struct snd_kcontrol_new xonar_playback_controls[] = {
                 .get = xonar_gpio_bit_switch_get,
                 .put = xonar_gpio_bit_switch_put,
                 .private_value = GPIO_D1_FRONT_PANEL,
-        }
+        },
+        // routing matrix: which channel pair of the stream each output plays
+        XONAR_DAC_SOURCE("Front Playback Source", 0),
+        XONAR_DAC_SOURCE("Surround Playback Source", 1),
+        XONAR_DAC_SOURCE("Center/LFE Playback Source", 2),
+        XONAR_DAC_SOURCE("Back Playback Source", 3),
+        // fade to these levels in "Xonar Volume Fade Time" milliseconds
+        {
+                .iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+                .name = "Xonar Volume Fade",
+                .access = SNDRV_CTL_ELEM_ACCESS_READWRITE |
+                          SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+                .info = xonar_vol_info,
+                .get = xonar_fade_get,
+                .put = xonar_fade_put,
+                .tlv = { .p = xonar_db_scale },
+        },
+        {
+                .iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+                .name = "Xonar Volume Fade Time",
+                .info = xonar_fade_time_info,
+                .get = xonar_fade_time_get,
+                .put = xonar_fade_time_put,
+        },
+        // whole mixer state in one write, see struct xonar_scene
+        {
+                .iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+                .name = "Xonar Scene",
+                .info = xonar_scene_info,
+                .get = xonar_scene_get,
+                .put = xonar_scene_put,
+        },
+        // read-only, changes are notified
+        {
+                .iface = SNDRV_CTL_ELEM_IFACE_CARD,
+                .name = "External Power",
+                .access = SNDRV_CTL_ELEM_ACCESS_READ,
+                .info = snd_ctl_boolean_mono_info,
+                .get = xonar_ext_power_get,
+        },
 };
 
 /**
@@ -163,6 +623,13 @@ int oxygen_mixer_init(struct xonar *chip) {
     struct snd_kcontrol *ctl;
     int i, err;
 
+    BUILD_BUG_ON(ARRAY_SIZE(xonar_playback_controls) !=
+                 ARRAY_SIZE(chip->controls));
+
+    // nothing to fade from yet, the targets are the current levels
+    for (i = 0; i < chip->dac_channels_mixer; ++i)
+        chip->fade_to[i] = chip->dac_volume[i];
+
     for (i = 0; i < ARRAY_SIZE(xonar_playback_controls); ++i) {
         // get the template for current control
         template = xonar_playback_controls[i];
@@ -180,5 +647,6 @@ int oxygen_mixer_init(struct xonar *chip) {
         // set free function for the control (it frees all controls)
         ctl->private_free = oxygen_any_ctl_free;
     }
+    return 0;
 }
 
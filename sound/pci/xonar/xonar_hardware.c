@@ -45,6 +45,8 @@
 
 #include <linux/pci.h>
 #include <linux/delay.h>
+#include <linux/workqueue.h>
+#include <linux/bitops.h>
 #include <sound/ac97_codec.h>
 #include <sound/control.h>
 #include <sound/core.h>
@@ -95,9 +97,9 @@ void xonar_dx_init(struct xonar *chip) {
     // number of channels in pcm and mixer controls
     chip->dac_channels_pcm = 8,
     chip->dac_channels_mixer = 8,
-    // max and min vol level
-    chip->dac_volume_min = 127 - 60,
-    chip->dac_volume_max = 127,
+    // max and min vol level in 0.5 dB steps: 255 is 0 dB, the minimum is -60 dB
+    chip->dac_volume_min = 255 - 2 * 60,
+    chip->dac_volume_max = 255,
 
     chip->dac_mute = 0;
     for (i = 0; i < 8; i++) {
@@ -189,6 +191,8 @@ static void cs4398_write(struct xonar *chip, u8 reg, u8 value);
 static void cs4362a_write(struct xonar *chip, u8 reg, u8 value);
 void xonar_dx_cleanup(struct xonar *chip)
 {
+    // pending volume/mute writes must not reach the DACs after power down
+    xonar_i2c_flush(chip);
     // disable output from the card
     xonar_disable_output(chip);
     // disable first DAC
@@ -233,43 +237,141 @@ void set_cs43xx_params(struct xonar *chip, struct snd_pcm_hw_params *params)
     cs4362a_fm &= CS4362A_FM_MASK;
     cs4362a_fm |= data->cs4362a_regs[9] & ~CS4362A_FM_MASK;
     cs4362a_write_cached(chip, 9, cs4362a_fm);
+    // the caller flushes the queue, the DACs must be in the new speed mode
+    // before the stream starts
 }
 
 
 // HARDWARE WRITES
 
+// direct writes go to the bus immediately and replace a queued value
+
+static void cs43xx_write(struct xonar *chip, u8 device, u8 *regs, u16 *dirty,
+			 unsigned int count, u8 reg, u8 value)
+{
+	mutex_lock(&chip->i2c_mutex);
+	spin_lock(&chip->i2c_lock);
+	if (reg < count) {
+		regs[reg] = value;
+		*dirty &= ~(1u << reg);
+	}
+	spin_unlock(&chip->i2c_lock);
+	oxygen_write_i2c(chip, device, reg, value);
+	mutex_unlock(&chip->i2c_mutex);
+}
+
 static void cs4398_write(struct xonar *chip, u8 reg, u8 value)
 {
-	struct xonar *data = chip;
+	cs43xx_write(chip, I2C_DEVICE_CS4398, chip->cs4398_regs,
+		     &chip->cs4398_dirty, ARRAY_SIZE(chip->cs4398_regs),
+		     reg, value);
+}
 
-	oxygen_write_i2c(chip, I2C_DEVICE_CS4398, reg, value);
-	if (reg < ARRAY_SIZE(data->cs4398_regs))
-		data->cs4398_regs[reg] = value;
+static void cs4362a_write(struct xonar *chip, u8 reg, u8 value)
+{
+	cs43xx_write(chip, I2C_DEVICE_CS4362A, chip->cs4362a_regs,
+		     &chip->cs4362a_dirty, ARRAY_SIZE(chip->cs4362a_regs),
+		     reg, value);
+}
+
+/*
+ * I2C SUBMISSION QUEUE
+ *
+ * Cached writes don't wait for the bus. The queue is kept as dirty bits over
+ * cs4398_regs/cs4362a_regs: the arrays always hold the latest value, so a
+ * second write to a register that is still pending only replaces the value
+ * and the bus sees one write per register per drain. i2c_work drains the
+ * queue; xonar_i2c_flush() is the barrier for paths that need ordering.
+ *
+ * The queue is protected by chip->i2c_lock and the bus by chip->i2c_mutex,
+ * chip->mutex is never held while waiting for the bus from the work, so the
+ * mixer controls (which hold chip->mutex) only update the state and return.
+ */
+static void xonar_i2c_queue(struct xonar *chip, u8 *regs, u16 *dirty,
+			    u8 reg, u8 value)
+{
+	bool queued = false;
+
+	spin_lock(&chip->i2c_lock);
+	if (value != regs[reg]) {
+		regs[reg] = value;
+		++chip->i2c_queued;
+		if (*dirty & (1u << reg))
+			++chip->i2c_coalesced;
+		*dirty |= 1u << reg;
+		queued = true;
+	}
+	spin_unlock(&chip->i2c_lock);
+	if (queued)
+		schedule_work(&chip->i2c_work);
 }
 
 static void cs4398_write_cached(struct xonar *chip, u8 reg, u8 value)
 {
-	struct xonar *data = chip;
+	xonar_i2c_queue(chip, chip->cs4398_regs, &chip->cs4398_dirty,
+			reg, value);
+}
 
-	if (value != data->cs4398_regs[reg])
-		cs4398_write(chip, reg, value);
+static void cs4362a_write_cached(struct xonar *chip, u8 reg, u8 value)
+{
+	xonar_i2c_queue(chip, chip->cs4362a_regs, &chip->cs4362a_dirty,
+			reg, value);
 }
 
-static void cs4362a_write(struct xonar *chip, u8 reg, u8 value)
+/*
+ * Take the lowest pending register off the queue, false if it is empty.
+ */
+static bool xonar_i2c_next(struct xonar *chip, u8 *device, u8 *reg, u8 *value)
 {
-	struct xonar *data = chip;
+	bool found = true;
+
+	spin_lock(&chip->i2c_lock);
+	if (chip->cs4398_dirty) {
+		*device = I2C_DEVICE_CS4398;
+		*reg = __ffs(chip->cs4398_dirty);
+		*value = chip->cs4398_regs[*reg];
+		chip->cs4398_dirty &= ~(1u << *reg);
+	} else if (chip->cs4362a_dirty) {
+		*device = I2C_DEVICE_CS4362A;
+		*reg = __ffs(chip->cs4362a_dirty);
+		*value = chip->cs4362a_regs[*reg];
+		chip->cs4362a_dirty &= ~(1u << *reg);
+	} else {
+		found = false;
+	}
+	spin_unlock(&chip->i2c_lock);
+	return found;
+}
+
+/*
+ * Send all pending writes. A value taken from the queue is on the bus before
+ * i2c_mutex is released, so a newer value can't be overtaken by an older one.
+ */
+static void xonar_i2c_drain(struct xonar *chip)
+{
+	u8 device, reg, value;
 
-	oxygen_write_i2c(chip, I2C_DEVICE_CS4362A, reg, value);
-	if (reg < ARRAY_SIZE(data->cs4362a_regs))
-		data->cs4362a_regs[reg] = value;
+	mutex_lock(&chip->i2c_mutex);
+	while (xonar_i2c_next(chip, &device, &reg, &value))
+		oxygen_write_i2c(chip, device, reg, value);
+	mutex_unlock(&chip->i2c_mutex);
 }
 
-static void cs4362a_write_cached(struct xonar *chip, u8 reg, u8 value)
+void xonar_i2c_work(struct work_struct *work)
 {
-	struct xonar *data = chip;
+	struct xonar *chip = container_of(work, struct xonar, i2c_work);
 
-	if (value != data->cs4362a_regs[reg])
-		cs4362a_write(chip, reg, value);
+	xonar_i2c_drain(chip);
+}
+
+/**
+ * Write out everything queued so far before returning.
+ * May be called with chip->mutex held, but not with chip->i2c_mutex.
+ */
+void xonar_i2c_flush(struct xonar *chip)
+{
+	cancel_work_sync(&chip->i2c_work);
+	xonar_i2c_drain(chip);
 }
 
 static void cs43xx_registers_init(struct xonar *chip)
@@ -308,6 +410,15 @@ static void cs43xx_registers_init(struct xonar *chip)
 
 // MIXER HARDWARE ACTIONS
 
+/**
+ * CS4362A attenuation for a volume level; the chip has 1 dB steps only, and
+ * the mixer keeps its channels at whole dB levels (xonar_vol_step())
+ */
+static u8 cs4362a_attenuation(u8 volume)
+{
+    return (255 - volume + 1) / 2;
+}
+
 /**
  * Update hardware registers for volume level
  */
@@ -317,11 +428,12 @@ void update_xonar_volume(struct xonar *chip)
     u8 mute;
 
     // update volume on front output DAC
-    cs4398_write_cached(chip, 5, (127 - chip->dac_volume[0]) * 2);
-    cs4398_write_cached(chip, 6, (127 - chip->dac_volume[1]) * 2);
+    // CS4398 attenuates in 0.5 dB steps, like the control
+    cs4398_write_cached(chip, 5, 255 - chip->dac_volume[0]);
+    cs4398_write_cached(chip, 6, 255 - chip->dac_volume[1]);
 
-    // log the information
-    printk(KERN_ERR "Front volume changed to: %d", chip->dac_volume[0]);
+    // log the information (debug level, fades change it every few ms)
+    dev_dbg(chip->card->dev, "Front volume changed to: %d", chip->dac_volume[0]);
 
     // for the rest of the outs
     // check if should be muted and set mute flag if needed; it's needed because mute is set in the same register as volume
@@ -329,7 +441,7 @@ void update_xonar_volume(struct xonar *chip)
     // update sound vol/mute
     for (i = 0; i < 6; ++i)
         cs4362a_write_cached(chip, 7 + i + i / 2,
-                             (127 - chip->dac_volume[2 + i]) | mute);
+                             cs4362a_attenuation(chip->dac_volume[2 + i]) | mute);
 }
 
 /**
@@ -358,7 +470,31 @@ void update_xonar_mute(struct xonar *chip) {
     // update sound vol/mute
     for (i = 0; i < 6; ++i)
         cs4362a_write_cached(chip, 7 + i + i / 2,
-                             (127 - chip->dac_volume[2 + i]) | mute);
+                             cs4362a_attenuation(chip->dac_volume[2 + i]) | mute);
+}
+
+/**
+ * Update the DAC sources in the playback routing; the stream keeps running.
+ * DACs whose source pair isn't in the layout of the stream are muted.
+ */
+u16 xonar_play_routing(struct xonar *chip)
+{
+    unsigned int pairs = chip->play_channels ? chip->play_channels / 2 : 4;
+    unsigned int i;
+    u16 reg = 0;
+
+    for (i = 0; i < ARRAY_SIZE(chip->dac_sources); ++i) {
+        reg |= chip->dac_sources[i] << (OXYGEN_PLAY_DAC0_SOURCE_SHIFT + 2 * i);
+        if (chip->dac_sources[i] >= pairs)
+            reg |= OXYGEN_PLAY_MUTE01 << i;
+    }
+    return reg;
+}
+
+void update_xonar_routing(struct xonar *chip)
+{
+    oxygen_write16_masked(chip, OXYGEN_PLAY_ROUTING, xonar_play_routing(chip),
+                          XONAR_PLAY_ROUTING_MASK);
 }
 
 
@@ -378,5 +514,9 @@ void dump_registers(struct xonar *chip, struct snd_info_buffer *buffer)
     for (i = 1; i <= 14; ++i)
         snd_iprintf(buffer, " %02x", chip->cs4362a_regs[i]);
     snd_iprintf(buffer, "\n");
+
+    // I2C queue: writes submitted and writes replaced before reaching the bus
+    snd_iprintf(buffer, "\nI2C queue: %lu queued, %lu coalesced\n",
+                chip->i2c_queued, chip->i2c_coalesced);
 }
 
@@ -6,6 +6,7 @@
  */
 
 #include <linux/delay.h>
+#include <linux/workqueue.h>
 #include <sound/core.h>
 #include <sound/control.h>
 #include <sound/pcm.h>
@@ -20,17 +21,33 @@
 #define GPIO_CS53x1_M_QUAD	0x0008
 
 /**
- * Enable output of the card
+ * Enable output of the card.
+ * The output is switched on by output_enable_work once the anti-pop delay has
+ * passed, so the caller (e.g. probe) doesn't have to wait for it.
  */
 void xonar_enable_output(struct xonar *chip)
 {
 	struct xonar *data = chip;
     // set GPIO enable_output bit as the input to make set possible
 	oxygen_set_bits16(chip, OXYGEN_GPIO_CONTROL, data->output_enable_bit);
-	// sleep to make sure second command works well
-	msleep(data->anti_pop_delay);
+	// wait to make sure second command works well
+	schedule_delayed_work(&data->output_enable_work,
+			      msecs_to_jiffies(data->anti_pop_delay));
+}
+
+/**
+ * Second half of xonar_enable_output(), after the anti-pop delay
+ */
+void xonar_output_enable_work(struct work_struct *work)
+{
+	struct xonar *chip = container_of(to_delayed_work(work), struct xonar,
+					  output_enable_work);
+
 	// enable output bit on GPIO
-	oxygen_set_bits16(chip, OXYGEN_GPIO_DATA, data->output_enable_bit);
+	spin_lock_irq(&chip->lock);
+	oxygen_set_bits16(chip, OXYGEN_GPIO_DATA, chip->output_enable_bit);
+	spin_unlock_irq(&chip->lock);
+	dev_dbg(chip->card->dev, "output enabled\n");
 }
 
 
@@ -40,8 +57,12 @@ void xonar_enable_output(struct xonar *chip)
 void xonar_disable_output(struct xonar *chip)
 {
 	struct xonar *data = chip;
+	// the output must not come back on after this
+	cancel_delayed_work_sync(&data->output_enable_work);
     // disable output pin on GPIO
+	spin_lock_irq(&chip->lock);
 	oxygen_clear_bits16(chip, OXYGEN_GPIO_DATA, data->output_enable_bit);
+	spin_unlock_irq(&chip->lock);
 }
 
 /**
@@ -65,6 +86,10 @@ void xonar_ext_power_gpio_changed(struct xonar *chip)
 			// I think that this situation doesn't matter in this project
 			/* TODO: stop PCMs */
 		}
+		// wake up clients waiting for the "External Power" control
+		if (chip->controls[XONAR_CTL_EXT_POWER])
+			snd_ctl_notify(chip->card, SNDRV_CTL_EVENT_MASK_VALUE,
+				       &chip->controls[XONAR_CTL_EXT_POWER]->id);
 	}
 }
 